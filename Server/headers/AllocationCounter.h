@@ -0,0 +1,14 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#ifndef SNAKE_ALLOCATIONCOUNTER_H
+#define SNAKE_ALLOCATIONCOUNTER_H
+
+/*
+ * Every operator new in the program, counted by replacing the global one. Only linked into the headless server,
+ * which logs it so a server in steady state can be checked for allocating per turn.
+ */
+unsigned long long heapAllocations();
+
+#endif //SNAKE_ALLOCATIONCOUNTER_H
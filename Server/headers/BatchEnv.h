@@ -0,0 +1,87 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#ifndef SNAKE_BATCHENV_H
+#define SNAKE_BATCHENV_H
+
+#include <vector>
+#include "GameState.h"
+
+/*
+ * Many games of one layout stepped together, for training bots. No players, clocks or network: the caller
+ * hands in every snake's move and gets the results written straight into buffers it owns.
+ *
+ * Every buffer is laid out environment by environment (structure of arrays, one array per kind of output):
+ *  - observations: numRows * numCols bytes per environment, row by row, holding Cell values
+ *    (0 empty, 1 food, Cell::FIRST_SNAKE + id for snakes),
+ *  - rewards: one float per snake, the length it gained this step, or -1 on the step it died,
+ *  - dones: one byte per environment, set on the step its game ended,
+ *  - alive: one byte per snake (optional),
+ *  - heads: row and column per snake (optional).
+ *
+ * Every environment holds a game from construction on, and one that finishes is reset in place with a new seed
+ * straight away, so after a step with done set its observation is already the first one of the next game.
+ */
+class BatchEnv {
+public:
+    struct Buffers {
+        uint8_t* observations = nullptr;
+        float* rewards = nullptr;
+        uint8_t* dones = nullptr;
+        uint8_t* alive = nullptr;
+        uint32_t* heads = nullptr;
+    };
+
+    //maxTurns ends games that go on too long, 0 lets them run until one snake is left
+    BatchEnv(const GameConfig& config, unsigned int numEnvs, uint64_t seed, unsigned int maxTurns = 0);
+
+    //The buffers have to stay valid until they are replaced. Outputs without a buffer are skipped
+    void setBuffers(const Buffers& buffers);
+
+    //Starts a new game in every environment and writes the observations
+    void reset();
+
+    //moves holds numSnakes() moves per environment (0 up, 1 right, 2 down, 3 left). Moves of dead snakes are ignored
+    void step(const uint8_t* moves);
+
+    [[nodiscard]] inline unsigned int numEnvs() const {
+        return envs.size();
+    }
+
+    [[nodiscard]] inline unsigned int numSnakes() const {
+        return config.snakes.size();
+    }
+
+    [[nodiscard]] inline unsigned int numRows() const {
+        return config.numRows;
+    }
+
+    [[nodiscard]] inline unsigned int numCols() const {
+        return config.numCols;
+    }
+
+    [[nodiscard]] inline const GameState& getEnv(unsigned int env) const {
+        return envs[env];
+    }
+
+private:
+    GameConfig config;
+    unsigned int maxTurns;
+
+    //Draws the seed for every new game
+    GameRng seeds;
+
+    std::vector<GameState> envs;
+    Buffers buffers;
+
+    //Reused every step
+    std::vector<Move> moveScratch;
+    std::vector<unsigned int> sizesBefore;
+    std::vector<Player*> noPlayers;
+
+    void resetEnv(unsigned int env);
+    void writeObservation(unsigned int env);
+};
+
+#endif //SNAKE_BATCHENV_H
@@ -0,0 +1,97 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#ifndef SNAKE_BITBOARD_H
+#define SNAKE_BITBOARD_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * One bit per square of a walled grid, using the same indices as GameState's grid, so moving a row up or down
+ * is a shift by the stride. There are zeroed words either side of the bits and the word count is rounded up,
+ * which lets the kernels read a row past either end and work on whole vectors without bounds checks.
+ */
+class BitBoard {
+public:
+    BitBoard() = default;
+
+    BitBoard(unsigned int numSquares, unsigned int stride);
+
+    [[nodiscard]] inline bool test(unsigned int i) const {
+        return (words()[i >> 6] >> (i & 63)) & 1;
+    }
+
+    inline void set(unsigned int i) {
+        words()[i >> 6] |= 1ull << (i & 63);
+    }
+
+    inline void reset(unsigned int i) {
+        words()[i >> 6] &= ~(1ull << (i & 63));
+    }
+
+    inline void assign(unsigned int i, bool value) {
+        uint64_t bit = 1ull << (i & 63);
+        uint64_t& word = words()[i >> 6];
+        word = (word & ~bit) | (value ? bit : 0);
+    }
+
+    void clear();
+
+    [[nodiscard]] unsigned int count() const;
+
+    [[nodiscard]] inline unsigned int getNumWords() const {
+        return numWords;
+    }
+
+    [[nodiscard]] inline unsigned int getStride() const {
+        return stride;
+    }
+
+    [[nodiscard]] inline const uint64_t* words() const {
+        return data.data() + pad;
+    }
+
+    [[nodiscard]] inline uint64_t* words() {
+        return data.data() + pad;
+    }
+
+private:
+    unsigned int stride = 0;
+    unsigned int pad = 0;
+    unsigned int numWords = 0;
+    std::vector<uint64_t> data;
+};
+
+/*
+ * How much room there is on a board, worked out on BitBoards a whole frontier at a time.
+ * Keeps its own scratch boards for one board shape, so calls don't allocate once every head count has been seen.
+ * The frontier kernel uses AVX2 or SSE2 when the compiler targets them (see SNAKE_NATIVE_ARCH) and 64-bit words otherwise.
+ */
+class SpaceSearch {
+public:
+    SpaceSearch(unsigned int numSquares, unsigned int stride);
+
+    //Open squares that can be reached from start, not counting start itself. Stops counting around limit
+    unsigned int reachable(const BitBoard& open, unsigned int start, unsigned int limit = ~0u);
+
+    //Breadth first from every head at once. owned[i] is how many open squares heads[i] gets to before any other
+    //head. Squares that several heads reach on the same turn belong to nobody and block all of them.
+    //Stops after maxDepth turns, so only squares that close are counted
+    void partition(const BitBoard& open, const unsigned int* heads, unsigned int numHeads, unsigned int* owned,
+                   unsigned int maxDepth = ~0u);
+
+    //Which frontier kernel was compiled in
+    static const char* kernelName();
+
+private:
+    unsigned int numSquares, stride;
+
+    BitBoard visited, contested;
+    std::vector<BitBoard> frontiers, next;
+
+    void ensureHeads(unsigned int numHeads);
+};
+
+#endif //SNAKE_BITBOARD_H
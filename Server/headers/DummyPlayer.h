@@ -18,7 +18,7 @@ public:
         return savedMove;
     }
 
-    void onDeath(Game &game, Snake &snake, std::string reason, bool timeout) override;
+    void onDeath(Game &game, Snake &snake, const std::string& reason, bool timeout) override;
 
 private:
     static bool isMoveSafe(Move move, Game& game, Snake& snake);
@@ -7,122 +7,110 @@
 
 #include <set>
 #include <map>
+#include <memory>
+#include "GameState.h"
 #include "Snake.h"
 #include "Player.h"
+#include "GameScheduler.h"
+#include "Pacing.h"
+#include "SharedBuffer.h"
 
-#define TIMEOUT_MS 2000
+//Turns of moves a game's replay has room for up front. Longer games grow it as they go
+#define REPLAY_RESERVE_TURNS 1024
 
-#define ELO_D 400
-#define ELO_K 50
-
-enum class SquareType: char {
-    EMPTY, FOOD, SNAKE
-};
-
-struct Square {
-    SquareType type;
-    unsigned int snakeID;
-
-    inline bool canMoveTo() const {
-        return type == SquareType::EMPTY || type == SquareType::FOOD;
-    }
-
-    static Square empty() {
-        return {SquareType::EMPTY, 0};
-    }
-
-    static Square food() {
-        return {SquareType::FOOD, 0};
-    }
-
-    static Square snake(unsigned int id) {
-        return {SquareType::SNAKE, id};
-    }
-
-    bool operator<(const Square& other) const {
-        return std::tie(type, snakeID) < std::tie(other.type, other.snakeID);
-    }
-};
-
-struct GameConfig {
-    unsigned int numRows, numCols;
-    unsigned int numFood;
-
-    struct SnakeConfig {
-        Pos back;
-        std::vector<Move> body;
-
-        SnakeConfig(Pos back, std::vector<Move> body)
-            :back(back), body(body)
-        {}
-
-        SnakeConfig(std::initializer_list<Pos> body);
-
-        SnakeConfig()
-            :back(0, 0), body({})
-        {}
-    };
-
-    std::vector<SnakeConfig> snakes;
-
-    static GameConfig fromFile(const std::string& filename);
-};
+struct Replay;
 
 struct Changes {
-    std::set<std::pair<Pos, Square>> changes;
+    //Sorted by position (row, then column), each position at most once
+    std::vector<std::pair<Pos, Cell>> changes;
     unsigned int newTurn;
+
+    //The part of GAME_CHANGES that is the same for every player, encoded by the first player that needs it.
+    //Owned by encodedBuffers, which keeps it for a later turn once every connection is done sending it
+    SharedBuffer* encoded = nullptr;
+    bool isEncoded = false;
+    SharedBufferPool encodedBuffers;
+
+    //The same for GAME_CHANGES_V2, for connections that asked for it
+    SharedBuffer* compactEncoded = nullptr;
+    bool isCompactEncoded = false;
+    SharedBufferPool compactEncodedBuffers;
 };
 
-class Game {
+/*
+ * A game on the server: the rules from GameState, plus the players, the turn timing and what gets sent out.
+ */
+class Game: public GameState {
 public:
-    Game(GameConfig& config, std::vector<Player*>& players);
+    //The same seed and the same moves always play out the same game
+    Game(GameConfig& config, std::vector<Player*>& players, uint64_t seed, const Pacing& pacing,
+         GameScheduler* scheduler = nullptr);
     ~Game();
 
-    [[nodiscard]] Square getSquare(Pos pos) const;
-    Square setSquare(Pos pos, Square value);
+    //Ticks if every move is in (and, with fixed pacing, the minimum turn time has passed) or if the move timeout has run out
+    void tryTick(GameClock::time_point now);
+
+    //Called by players when their move comes in
+    void onMoveReady();
 
-    inline bool isWithinBounds(Pos pos) {
-        return pos.row < this->numRows && pos.col < this->numCols && pos.row >= 0 && pos.col >= 0;
+    //How long the players get to answer the move request of the current turn
+    [[nodiscard]] inline unsigned int getMoveTimeoutMs() const {
+        return moveTimeoutMs;
     }
 
-    void tryTick();
+    [[nodiscard]] inline const Pacing& getPacing() const {
+        return pacing;
+    }
 
-    unsigned int getNumRows() const;
+    //Turns played by every game on the server so far
+    static unsigned long long turnsPlayed();
 
-    unsigned int getNumCols() const;
+    [[nodiscard]] inline unsigned long long getSerial() const {
+        return serial;
+    }
 
-    bool hasGameEnded() const;
+    //Recorded as the game goes, complete once it has finished
+    [[nodiscard]] inline const Replay& getReplay() const {
+        return *replay;
+    }
 private:
-    unsigned int numRows, numCols, numFood;
-    unsigned int currTurn = 0;
-    Square* grid;
-    std::set<Pos> changes;
-    std::vector<Snake> snakes;
-    std::vector<Snake*> snakesDeadThisTurn;
+    const unsigned long long serial;
+    GameScheduler* scheduler;
+
+    std::unique_ptr<Replay> replay;
+
+    //Reused every turn
+    Changes changesToBroadcast;
+    std::vector<Move> turnMoves;
+    std::string deathReason;
 
     friend class GameDisplay;
     friend class GameCreator;
+    friend class GameShard;
+    friend class ServerDisplay;
+    friend class GameScheduler;
 
-    long long lastMoveAsk;
+    //Kept by the scheduler
+    GameClock::time_point wakeAt;
+    size_t heapIndex = NOT_SCHEDULED;
 
-    std::map<Snake*, float> expectedScores;
+    const Pacing pacing;
+
+    GameClock::time_point lastMoveAsk;
+    unsigned int movesPending = 0;
+    //Set while requestMoves() asks the players, some of which answer on the spot
+    bool askingForMoves = false;
+    unsigned int moveTimeoutMs;
 
     void pushChanges();
     void requestMoves();
 
-    void updateFood();
-
-    [[nodiscard]] inline unsigned int idx(Pos pos) const {
-        return pos.row * numCols + pos.col;
-    }
-
-    bool isTimeout() const;
-
-    void killSnake(Snake* snake, std::string reason, bool timeout);
-
-    void tick();
+    [[nodiscard]] unsigned int minTurnMs() const;
+    //Worked out from the players' response times with adaptive pacing
+    [[nodiscard]] unsigned int nextMoveTimeoutMs() const;
 
-    bool canTick() const;
+    //Tells the players of snakes that died this turn
+    void reportDeaths();
 
     void finish();
 };
@@ -5,39 +5,73 @@
 #ifndef SNAKE_GAMECREATOR_H
 #define SNAKE_GAMECREATOR_H
 
+#include <functional>
+#include <memory>
+
 #include "Game.h"
-#include "render/GameDisplay.h"
+#include "GameShard.h"
+#include "ServerConfig.h"
+#include "Replay.h"
+
+inline std::string layoutPath(const std::string& name) {
+    return "./res/layouts/" + name + ".json";
+}
 
+/*
+ * Matchmaking. Lives on the main thread with the network; the games themselves run on shards.
+ */
 class GameCreator {
 public:
     friend class ConfigMenu;
-    GameCreator(unsigned int targetGameAmount);
+    friend class ServerDisplay;
+    explicit GameCreator(const ServerConfig& serverConfig);
+    ~GameCreator();
+
+    //Starts the shard threads (if there are any). wakeMain is called from them when they have output for tick()
+    void start(std::function<void()> wakeMain);
 
     void addPlayer(Player* player);
 
     void tick();
 
-    void render();
+    //How long the caller may sleep before tick() has anything to do, at most maxMs
+    int msUntilNextTick(int maxMs) const;
 
     std::string getPlayerName(std::string basicString);
 
     Color getPlayerColor(Color color);
 
 private:
+    ServerConfig serverConfig;
     GameConfig config;
+    //Every new game gets this, from the server config and the layout
+    Pacing pacing;
+
+    //Every connected player, free or in a game
+    std::vector<Player*> players;
     std::vector<Player*> freePlayers;
 
-    std::vector<GameDisplay> displays;
-    std::vector<Game*> games;
+    //The players from num_bots. Declared before shards so they outlive the games on them
+    std::vector<std::unique_ptr<Player>> builtInBots;
+
+    std::vector<std::unique_ptr<GameShard>> shards;
+    std::function<void()> wakeMain;
+
+    //Null when recording is off
+    std::unique_ptr<ReplayWriter> replayWriter;
 
     unsigned int targetGameAmount;
     unsigned int currentGameAmount = 0;
 
-    //Config state
-    char fileBuf[64];
+    [[nodiscard]] inline bool isThreaded() const {
+        return serverConfig.numThreads > 0;
+    }
 
-    void tryShrink();
+    void handleShardOutput(GameShard& shard);
+    void endGame(GameShard& shard, Game* game);
+    void removePlayer(Player* player);
 
+    void addBuiltInBots();
     void tryMakeNewGame();
 };
 
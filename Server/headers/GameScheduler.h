@@ -0,0 +1,56 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#ifndef SNAKE_GAMESCHEDULER_H
+#define SNAKE_GAMESCHEDULER_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+class Game;
+
+using GameClock = std::chrono::steady_clock;
+
+//Game::heapIndex of a game with no wake up pending
+#define NOT_SCHEDULED ((size_t) -1)
+
+/*
+ * Decides when games need to be looked at. A game asks to be woken when it asks for moves (for its timeout) and
+ * again once its last move has arrived (for the earliest time it may tick).
+ * Games with nothing due are never touched.
+ *
+ * Each game has at most one wake up pending, kept in a heap that knows where every game is, so asking for an earlier
+ * one moves it instead of leaving stale entries behind. A game woken before it can tick asks again for when it can.
+ */
+class GameScheduler {
+public:
+    void add(Game* game);
+    void remove(Game* game);
+
+    //Only ever moves the game's wake up earlier. A later time than the pending one is already covered by it
+    void schedule(Game* game, GameClock::time_point when);
+
+    //Next game whose time has come, or nullptr if there is none. It has nothing pending after this
+    Game* popDue(GameClock::time_point now);
+
+    //Time until the earliest pending wake up, clamped to maxMs. 0 if something is already due
+    int msUntilNextDue(GameClock::time_point now, int maxMs) const;
+
+    [[nodiscard]] inline size_t size() const {
+        return numGames;
+    }
+private:
+    //Ordered by Game::wakeAt, each game knows its own position (Game::heapIndex)
+    std::vector<Game*> heap;
+    size_t numGames = 0;
+
+    void siftUp(size_t i);
+    void siftDown(size_t i);
+    void place(size_t i, Game* game);
+    void erase(size_t i);
+};
+
+
+#endif //SNAKE_GAMESCHEDULER_H
@@ -0,0 +1,132 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#ifndef SNAKE_GAMESHARD_H
+#define SNAKE_GAMESHARD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "Game.h"
+#include "GameScheduler.h"
+#include "SpscQueue.h"
+#include "network/SmallPacket.h"
+
+class Connection;
+class SharedBuffer;
+
+/*
+ * A group of games that all run on one thread. Every game lives on exactly one shard for its whole life,
+ * and the shard is the only thing that touches it (and its players' game callbacks) until it has finished.
+ *
+ * Talking to a shard from the main thread only goes through two queues:
+ *  - commands (new games, moves from the network) go in,
+ *  - packets for connections and finished games come out, in the order they were produced.
+ *
+ * A shard started without a thread is ticked by its owner instead, which the windowed server needs since it
+ * reads games while rendering.
+ */
+class GameShard {
+public:
+    GameShard(unsigned int id, std::function<void()> onOutput);
+    ~GameShard();
+
+    void start();
+    void stop();
+
+    //Main thread
+    void postNewGame(const GameConfig& config, const Pacing& pacing, std::vector<Player*> players, uint64_t seed);
+    void postMove(Player* player, Move move, std::optional<unsigned int> turn);
+
+    //Game thread
+    //Takes one reference to payload
+    void postPacket(Connection* connection, const SmallPacket& packet, SharedBuffer* payload = nullptr);
+    //The main thread closes the connection once it has sent what was posted before
+    void postDropConnection(Connection* connection);
+
+    struct Output {
+        enum Type {
+            PACKET, DROP_CONNECTION, GAME_FINISHED
+        } type;
+
+        Connection* connection;
+        //Copied into the queue's storage, which is recycled
+        SmallPacket packet;
+        SharedBuffer* payload;
+
+        Game* game;
+    };
+
+    //Main thread. Payload references are owned by the caller once popped, finished games have already been removed from the shard
+    bool popOutput(Output& out);
+
+    //Only for shards without a thread
+    void tick(GameClock::time_point now);
+    int msUntilNextTick(GameClock::time_point now, int maxMs) const;
+
+    //Only safe to read from the thread that ticks this shard
+    std::vector<Game*> games;
+
+    //Maintained by the main thread to balance games between shards
+    unsigned int numGames = 0;
+
+    [[nodiscard]] inline unsigned int getID() const {
+        return id;
+    }
+private:
+    struct NewGame {
+        GameConfig config;
+        Pacing pacing;
+        std::vector<Player*> players;
+        uint64_t seed;
+    };
+
+    struct Command {
+        enum Type {
+            NEW_GAME, MOVE
+        } type;
+
+        Player* player;
+        Move move;
+        std::optional<unsigned int> turn;
+
+        //Owned by the queue until the shard picks it up
+        NewGame* newGame;
+    };
+
+    const unsigned int id;
+
+    GameScheduler scheduler;
+
+    //Players in this shard's games. Moves for anyone else arrived too late and are dropped
+    std::unordered_set<Player*> players;
+
+    SpscQueue<Command> commands;
+    SpscQueue<Output> output;
+    bool producedOutput = false;
+    std::function<void()> onOutput;
+
+    std::thread thread;
+    std::atomic<bool> running = false;
+
+    //Only used to put the thread to sleep, the queues themselves are lock-free
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<bool> sleeping = false;
+    bool woken = false;
+
+    void run();
+    void wake();
+
+    void handleCommands();
+    void finishGame(Game* game);
+};
+
+
+#endif //SNAKE_GAMESHARD_H
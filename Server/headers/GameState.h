@@ -0,0 +1,316 @@
+//
+// Created by Anatol on 23/06/2022.
+//
+
+#ifndef SNAKE_GAMESTATE_H
+#define SNAKE_GAMESTATE_H
+
+#include <vector>
+#include <string>
+#include <tuple>
+#include "Snake.h"
+#include "utils.h"
+#include "BitBoard.h"
+
+#define ELO_D 400
+#define ELO_K 50
+
+enum class SquareType: char {
+    EMPTY, FOOD, SNAKE
+};
+
+struct Square {
+    SquareType type;
+    unsigned int snakeID;
+
+    inline bool canMoveTo() const {
+        return type == SquareType::EMPTY || type == SquareType::FOOD;
+    }
+
+    static Square empty() {
+        return {SquareType::EMPTY, 0};
+    }
+
+    static Square food() {
+        return {SquareType::FOOD, 0};
+    }
+
+    static Square snake(unsigned int id) {
+        return {SquareType::SNAKE, id};
+    }
+
+    bool operator<(const Square& other) const {
+        return std::tie(type, snakeID) < std::tie(other.type, other.snakeID);
+    }
+};
+
+/*
+ * What the game actually stores per square: one byte.
+ * The board has a ring of WALL cells around it, so stepping off the board lands on a cell that can't be
+ * moved to rather than needing a bounds check.
+ */
+struct Cell {
+    static constexpr uint8_t EMPTY = 0;
+    static constexpr uint8_t FOOD = 1;
+    static constexpr uint8_t WALL = 2;
+    static constexpr uint8_t FIRST_SNAKE = 3;
+
+    //Snake IDs have to fit in the rest of the byte
+    static constexpr unsigned int MAX_SNAKES = 256 - FIRST_SNAKE;
+
+    uint8_t value;
+
+    [[nodiscard]] inline bool canMoveTo() const {
+        return value <= FOOD;
+    }
+
+    [[nodiscard]] inline bool isSnake() const {
+        return value >= FIRST_SNAKE;
+    }
+
+    [[nodiscard]] inline SquareType type() const {
+        if (value == FOOD) return SquareType::FOOD;
+        if (value >= FIRST_SNAKE) return SquareType::SNAKE;
+        return SquareType::EMPTY;
+    }
+
+    [[nodiscard]] inline unsigned int snakeID() const {
+        return value >= FIRST_SNAKE ? value - FIRST_SNAKE : 0;
+    }
+
+    [[nodiscard]] inline Square toSquare() const {
+        return {type(), snakeID()};
+    }
+
+    bool operator==(const Cell& other) const {
+        return value == other.value;
+    }
+
+    bool operator<(const Cell& other) const {
+        return value < other.value;
+    }
+
+    static Cell empty() {
+        return {EMPTY};
+    }
+
+    static Cell food() {
+        return {FOOD};
+    }
+
+    static Cell wall() {
+        return {WALL};
+    }
+
+    static Cell snake(unsigned int id) {
+        return {(uint8_t) (FIRST_SNAKE + id)};
+    }
+};
+
+struct GameConfig {
+    unsigned int numRows, numCols;
+    unsigned int numFood;
+
+    struct SnakeConfig {
+        Pos back;
+        std::vector<Move> body;
+
+        SnakeConfig(Pos back, std::vector<Move> body)
+            :back(back), body(body)
+        {}
+
+        SnakeConfig(std::initializer_list<Pos> body);
+
+        SnakeConfig()
+            :back(0, 0), body({})
+        {}
+    };
+
+    std::vector<SnakeConfig> snakes;
+
+    static GameConfig fromFile(const std::string& filename);
+};
+
+enum class DeathCause: uint8_t {
+    TIMEOUT,
+    HEAD_COLLISION,
+    OUT_OF_BOUNDS,
+    OWN_BODY,
+    OTHER_BODY
+};
+
+//What players are told, except for timeouts which the server words itself
+const char* deathCauseName(DeathCause cause);
+
+struct SnakeResult {
+    bool died;
+    unsigned int length;
+    int score;
+    unsigned int diedOn;
+    unsigned int rank;
+    unsigned int numTies;
+    int newElo;
+};
+
+/*
+ * The rules and nothing else: the board, the snakes and the food, stepped a turn at a time from the moves it is given.
+ * Knows nothing about players, time or the network, so replays and tools can run games without any of those.
+ * Game builds the live server game on top of it.
+ */
+class GameState {
+public:
+    //Shuffles players into snake order. Entries may be null when nobody is playing, like when re-running a replay.
+    //With trackChanges, every square that is set is remembered until the owner takes the changes
+    GameState(const GameConfig& config, std::vector<Player*>& players, uint64_t seed, bool trackChanges);
+
+    //Starts a new game in place, exactly like constructing one with the same arguments but without reallocating.
+    //config has to have the same board size this state was made with
+    void reset(const GameConfig& config, std::vector<Player*>& players, uint64_t newSeed);
+
+    //Works for positions one step off the board, which are walls
+    [[nodiscard]] inline Cell getCell(Pos pos) const {
+        return this->grid[this->idx(pos)];
+    }
+
+    [[nodiscard]] inline Square getSquare(Pos pos) const {
+        return getCell(pos).toSquare();
+    }
+
+    Cell setCell(Pos pos, Cell value);
+
+    //numRows * numCols cell values, row by row, without the wall ring
+    void copyBoard(uint8_t* out) const;
+
+    inline bool isWithinBounds(Pos pos) const {
+        return pos.row < this->numRows && pos.col < this->numCols;
+    }
+
+    unsigned int getNumRows() const;
+
+    unsigned int getNumCols() const;
+
+    [[nodiscard]] inline unsigned int getTurn() const {
+        return currTurn;
+    }
+
+    [[nodiscard]] inline uint64_t getSeed() const {
+        return seed;
+    }
+
+    //Squares that can be moved to (empty or food), as bits at grid indices. Kept up to date by setCell
+    [[nodiscard]] inline const BitBoard& getOpen() const {
+        return open;
+    }
+
+    [[nodiscard]] inline const BitBoard& getFood() const {
+        return food;
+    }
+
+    //Grid index of a square, as used by getOpen() and getFood()
+    [[nodiscard]] inline unsigned int indexOf(Pos pos) const {
+        return idx(pos);
+    }
+
+    //Every grid index, including the wall ring
+    [[nodiscard]] inline unsigned int getNumIndices() const {
+        return (unsigned int) grid.size();
+    }
+
+    [[nodiscard]] inline unsigned int getStride() const {
+        return stride;
+    }
+
+    [[nodiscard]] inline const std::vector<Snake>& getSnakes() const {
+        return snakes;
+    }
+
+    bool hasGameEnded() const;
+
+    //Kills a snake that didn't send a move for this turn. Done before step()
+    void timeOut(unsigned int snake);
+
+    //Plays one turn. moves is indexed by snake ID, what it holds for dead snakes is ignored
+    void step(const Move* moves);
+
+    struct Death {
+        unsigned int snake;
+        DeathCause cause;
+    };
+
+    //Snakes that died since the last clearDeaths(), in the order they died
+    [[nodiscard]] inline const std::vector<Death>& getDeaths() const {
+        return deaths;
+    }
+
+    inline void clearDeaths() {
+        deaths.clear();
+    }
+
+    //A copy of the rules state (board, snakes, food and RNG) to play ahead on. Stepping it never calls players
+    //and doesn't record changes, whatever it was forked from
+    [[nodiscard]] GameState fork() const;
+
+    //Same as fork(), into a state that was forked before. Reuses its memory, so a search can fork over and over
+    //without allocating
+    void forkInto(GameState& out) const;
+
+    //Gives a fork its own food placement from here on, so searching it doesn't tell where food will appear
+    inline void reseed(uint64_t seed) {
+        this->rng = GameRng(seed);
+    }
+
+    //Ranks every snake and works out new ratings from the ones they started with (indexed by snake ID).
+    //Snakes still alive count as having lasted the whole game. results is indexed by snake ID
+    void computeResults(const std::vector<int>& elos, std::vector<SnakeResult>& results);
+
+protected:
+    uint64_t seed;
+    //Player order and food placement
+    GameRng rng;
+
+    unsigned int numRows, numCols, numFood;
+    unsigned int currTurn = 0;
+    //(numRows + 2) x (numCols + 2), including the wall ring
+    unsigned int stride;
+    std::vector<Cell> grid;
+    //Mirrors of grid for the space kernels in BitBoard.h
+    BitBoard open, food;
+
+    //Squares touched since the changes were last taken. The bitmap (one bit per grid index) keeps the list free of duplicates
+    bool trackChanges;
+    std::vector<uint64_t> dirty;
+    std::vector<unsigned int> changedCells;
+    //Grid indices of every empty square, in no order, so food can be placed without scanning the board.
+    //emptySlot maps a grid index to where it is in emptyCells. Both are kept up to date by setCell
+    std::vector<unsigned int> emptyCells;
+    std::vector<unsigned int> emptySlot;
+    static constexpr unsigned int NOT_EMPTY = ~0u;
+    unsigned int numFoodOnBoard = 0;
+
+    std::vector<Snake> snakes;
+    std::vector<Death> deaths;
+
+    //Where each living snake is going this turn, sorted by square. Reused every turn
+    struct HeadTarget {
+        Pos target;
+        unsigned int snake;
+    };
+    std::vector<HeadTarget> headTargets;
+
+    void updateFood();
+
+    //Rows and columns are unsigned, so -1 wraps around to the wall at index 0 after the +1
+    [[nodiscard]] inline unsigned int idx(Pos pos) const {
+        return (pos.row + 1) * stride + (pos.col + 1);
+    }
+
+    [[nodiscard]] inline Pos posOf(unsigned int idx) const {
+        return {idx / stride - 1, idx % stride - 1};
+    }
+
+    //sizeOnDeath has to be set first
+    void killSnake(Snake& snake, DeathCause cause);
+};
+
+
+#endif //SNAKE_GAMESTATE_H
@@ -0,0 +1,66 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#ifndef SNAKE_PACING_H
+#define SNAKE_PACING_H
+
+#include <cstdint>
+#include <string>
+
+//Response times kept per player for adaptive pacing
+#define RESPONSE_TIME_SAMPLES 64
+//Adaptive pacing waits the full timeout for players it has seen answer fewer times than this
+#define MIN_RESPONSE_SAMPLES 8
+
+enum class PacingMode: uint8_t {
+    //Ticks once every move is in, but never faster than minTurnMs. What the server has always done
+    FIXED,
+    //Ticks as soon as every move is in
+    FAST,
+    //Like FAST, and the move timeout comes from how fast the players have been answering
+    ADAPTIVE
+};
+
+/*
+ * How a game spaces out its turns. Set in server.json and overridden by a "pacing" object in the layout, e.g.
+ * "pacing": {"mode": "adaptive", "timeout_ms": 500}
+ */
+struct Pacing {
+    PacingMode mode = PacingMode::FIXED;
+
+    //FIXED only
+    unsigned int minTurnMs = 80;
+
+    //The longest a game waits for a move. Players that don't answer in time die and are kicked
+    unsigned int timeoutMs = 2000;
+
+    //ADAPTIVE: each turn waits margin times the percentile of the slowest alive player's recent response times,
+    //kept between minTimeoutMs and timeoutMs. Players that miss a shorter deadline die but aren't kicked
+    float percentile = 0.99f;
+    float margin = 2.0f;
+    unsigned int minTimeoutMs = 20;
+};
+
+//"fixed", "fast" or "adaptive". Returns false for anything else
+bool pacingModeFromName(const std::string& name, PacingMode& mode);
+const char* pacingModeName(PacingMode mode);
+
+//The last RESPONSE_TIME_SAMPLES response times of a player, in microseconds
+class ResponseTimes {
+public:
+    void add(uint32_t us);
+
+    //0 when there are no samples
+    [[nodiscard]] uint32_t percentile(float p) const;
+
+    [[nodiscard]] inline unsigned int size() const {
+        return count;
+    }
+private:
+    uint32_t samples[RESPONSE_TIME_SAMPLES];
+    unsigned int next = 0;
+    unsigned int count = 0;
+};
+
+#endif //SNAKE_PACING_H
@@ -7,17 +7,29 @@
 
 #include <cstdint>
 #include <utility>
+#include <atomic>
 #include <optional>
+#include <string>
 #include "utils.h"
+#include "Pacing.h"
+#include "GameScheduler.h"
 
 class Game;
+class GameShard;
 class Snake;
 class Changes;
 
 class Player {
 public:
     bool inGame = false;
-    bool kicked = false;
+    //Set from both the network thread and the game's shard
+    std::atomic<bool> kicked = false;
+
+    //Shard running this player's current game. Written by the main thread but read by the shard when sending
+    //(NetworkPlayer::send). That is safe because it is only set before the new game is pushed onto the shard's queue,
+    //which orders the write before the shard sees the game, and only cleared after the shard reported the game ended.
+    //Never change it while the player is in a game
+    GameShard* shard = nullptr;
 
     explicit Player(Color color, std::string name)
         :color(color),
@@ -31,8 +43,16 @@ public:
 
     }
 
-    void died(Game& game, Snake& snake, std::string reason, bool timeout) {
-        this->kicked = timeout;
+    //kick is false for timeouts shorter than the game's longest, which a slow but working player can miss
+    void died(Game& game, Snake& snake, const std::string& reason, bool timeout, bool kick) {
+        if (kick) {
+            this->kicked = true;
+        }
+        if (timeout) {
+            //Counts as a response this slow, so adaptive pacing waits longer for this player next time
+            recordResponseTime();
+        }
+        this->awaitingMoveFor = nullptr;
         onDeath(game, snake, reason, timeout);
     }
 
@@ -50,9 +70,27 @@ public:
 
     void askForNextMove(Game& game, Snake& snake) {
         savedMove = std::nullopt;
+        awaitingMoveFor = &game;
+        askedAt = GameClock::now();
         prepareNextMove(game, snake);
     }
 
+    //The game started its clock after asking everyone, so a player still thinking is timed from then
+    void restartMoveClock(GameClock::time_point now) {
+        if (awaitingMoveFor != nullptr) {
+            askedAt = now;
+        }
+    }
+
+    //The game won't ask for this player's move anymore (it's over), so stop telling it about moves
+    void stopAwaitingMove() {
+        awaitingMoveFor = nullptr;
+    }
+
+    //A move from outside (the network) for the current game, delivered on the game's thread.
+    //turn is the turn the client said the move is for, if it tags its moves
+    virtual void receiveMove(Move move, std::optional<unsigned int> turn) {}
+
     virtual void endGame(Game& game, Snake &snake, bool died, unsigned int length, int score, unsigned int diedOn, unsigned int rank, unsigned int numTies, int newElo){}
     virtual void onRemoved() {}
 
@@ -71,15 +109,29 @@ public:
     inline std::string getName() const {
         return name;
     }
+
+    //How long this player took to answer recently, measured by the game's shard
+    [[nodiscard]] inline const ResponseTimes& getResponseTimes() const {
+        return responseTimes;
+    }
 protected:
     virtual void prepareNextMove(Game& game, Snake& snake) = 0;
     virtual std::optional<Move> queryNextMove() = 0;
-    virtual void onDeath(Game& game, Snake& snake, std::string reason, bool timeout){}
+    virtual void onDeath(Game& game, Snake& snake, const std::string& reason, bool timeout){}
+
+    //Implementations call this once queryNextMove() has an answer, so the game can be scheduled instead of polled
+    void moveReady();
 private:
     Color color;
+    Game* awaitingMoveFor = nullptr;
     std::optional<Move> savedMove;
     std::string name;
 
+    GameClock::time_point askedAt;
+    ResponseTimes responseTimes;
+
+    void recordResponseTime();
+
     int elo = 1000;
 };
 
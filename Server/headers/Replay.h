@@ -0,0 +1,118 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#ifndef SNAKE_REPLAY_H
+#define SNAKE_REPLAY_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+
+#include "GameState.h"
+
+//"SNRP", little endian
+#define REPLAY_MAGIC 0x50524e53u
+#define REPLAY_VERSION 1
+
+/*
+ * Everything needed to play a game again: the layout, the seed and every move, plus who played and how it ended
+ * so a re-run can be checked against what really happened.
+ *
+ * Moves are 2 bits each. Every turn has one for each snake that was still alive after that turn's timeouts, in
+ * snake order, so the count per turn isn't stored and only comes out of re-running the game.
+ *
+ * Records are length prefixed and written back to back, so a replay file is just appended to.
+ */
+struct Replay {
+    struct PlayerInfo {
+        std::string name;
+        Color color;
+        //Before the game
+        int elo;
+    };
+
+    struct Timeout {
+        unsigned int turn;
+        unsigned int snake;
+    };
+
+    struct Result {
+        bool died;
+        unsigned int length;
+        unsigned int diedOn;
+        unsigned int rank;
+        int newElo;
+    };
+
+    unsigned long long serial = 0;
+    uint64_t seed = 0;
+    //Unix time
+    int64_t startTime = 0;
+
+    GameConfig config{};
+    //Indexed by snake ID
+    std::vector<PlayerInfo> players;
+
+    unsigned int numTurns = 0;
+    std::vector<Timeout> timeouts;
+
+    std::vector<uint8_t> moves;
+    size_t numMoves = 0;
+
+    //Indexed by snake ID, filled in when the game finishes
+    std::vector<Result> results;
+
+    inline void addMove(Move move) {
+        if (numMoves % 4 == 0) {
+            moves.push_back(0);
+        }
+
+        moves.back() |= move << (numMoves % 4 * 2);
+        numMoves++;
+    }
+
+    [[nodiscard]] inline Move getMove(size_t i) const {
+        return (Move) ((moves[i / 4] >> (i % 4 * 2)) & 3);
+    }
+
+    //Appends one record to out
+    void encode(std::vector<char>& out) const;
+    //Reads one record and moves data past it. Returns false if what is there isn't a whole, valid record
+    static bool decode(const char*& data, const char* end, Replay& replay);
+};
+
+/*
+ * Appends replays to a file on its own thread, so neither the games nor the network wait for the disk.
+ * Replays are encoded on the calling thread, which is the main thread.
+ */
+class ReplayWriter {
+public:
+    explicit ReplayWriter(const std::string& path);
+    ~ReplayWriter();
+
+    [[nodiscard]] inline bool isOpen() const {
+        return file != nullptr;
+    }
+
+    void write(const Replay& replay);
+
+private:
+    FILE* file;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    //Encoded records waiting for the thread
+    std::deque<std::vector<char>> pending;
+    bool stopping = false;
+
+    void run();
+};
+
+#endif //SNAKE_REPLAY_H
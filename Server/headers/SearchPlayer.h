@@ -0,0 +1,54 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#ifndef SNAKE_SEARCHPLAYER_H
+#define SNAKE_SEARCHPLAYER_H
+
+#include <memory>
+#include <string>
+#include "Player.h"
+#include "GameState.h"
+#include "BitBoard.h"
+
+/*
+ * Built-in bot for filling lobbies. Scores each safe move by head on collisions and food, then while the budget lasts
+ * by the room it leaves (flood fill and the squares it gets to before the other heads), then spends what is left on
+ * short random playouts of forks of the game.
+ * Answers straight from prepareNextMove on the game's thread, so the budget is how long it holds up the shard.
+ * It can only overrun by one move's room scoring, which is bounded by PARTITION_DEPTH.
+ */
+class SearchPlayer : public Player {
+public:
+    //A budget of 0 only does the cheap scoring
+    SearchPlayer(std::string name, Color color, unsigned int budgetUs);
+
+    void prepareNextMove(Game& game, Snake& snake) override;
+    std::optional<Move> queryNextMove() override {
+        return savedMove;
+    }
+
+private:
+    unsigned int budgetUs;
+    std::optional<Move> savedMove;
+
+    //Playouts, and the opponents' moves in them
+    GameRng rolloutRng;
+
+    //Made from the first game played, remade if the board changes size
+    std::unique_ptr<GameState> scratch;
+    std::unique_ptr<SpaceSearch> space;
+    std::vector<Move> moves;
+    std::vector<unsigned int> heads;
+    std::vector<unsigned int> owned;
+
+    Move chooseMove(const Game& game, const Snake& snake);
+    void prepareScratch(const Game& game);
+    void pickRandomMoves(const GameState& state);
+
+    //Turns the snake lasted out of the playout's length
+    float playout(const Game& game, unsigned int snake, Move first);
+};
+
+
+#endif //SNAKE_SEARCHPLAYER_H
@@ -0,0 +1,48 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#ifndef SNAKE_SERVERCONFIG_H
+#define SNAKE_SERVERCONFIG_H
+
+#include <string>
+#include "Pacing.h"
+
+#define SERVER_CONFIG_PATH "./res/server.json"
+#define DEFAULT_LAYOUT "smallfour"
+
+struct ServerConfig {
+    //Empty means ask on startup
+    std::string ip;
+
+    unsigned int numGames = 2;
+    //0 runs every game on the main thread
+    unsigned int numThreads = 0;
+
+    std::string layout = DEFAULT_LAYOUT;
+
+    //Bytes that may wait to be sent to one client before it is dropped for not keeping up
+    unsigned int maxSendBuffer = 1 << 20;
+
+    //Every finished game is appended here. Empty turns recording off
+    std::string replayFile = "./replays.bin";
+
+    //Built-in players added on startup, so games fill up when not enough bots are connected
+    unsigned int numBots = 0;
+    //"search" (SearchPlayer) or "dummy" (DummyPlayer, random safe moves)
+    std::string botType = "search";
+    //How long a search bot thinks per move, which is how long it holds up its shard. More plays better
+    unsigned int botBudgetUs = 200;
+
+    //From the "pacing" object. Layouts can override any of it
+    Pacing pacing;
+
+    //Missing file or keys keep their defaults
+    static ServerConfig fromFile(const std::string& filename);
+
+    //This config's pacing with the layout's "pacing" object on top
+    [[nodiscard]] Pacing pacingFor(const std::string& layoutFile) const;
+};
+
+
+#endif //SNAKE_SERVERCONFIG_H
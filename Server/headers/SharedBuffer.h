@@ -0,0 +1,131 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#ifndef SNAKE_SHAREDBUFFER_H
+#define SNAKE_SHAREDBUFFER_H
+
+#include <atomic>
+#include <vector>
+
+/*
+ * Reference counted bytes, for data that is encoded once and then sent to many connections.
+ * Starts with one reference owned by whoever created it. The count is atomic since the last release
+ * usually happens on the network thread, not the game thread that made it.
+ */
+class SharedBuffer {
+public:
+    static SharedBuffer* create(size_t size) {
+        return new SharedBuffer(size);
+    }
+
+    [[nodiscard]] inline char* data() {
+        return bytes.data();
+    }
+
+    [[nodiscard]] inline const char* data() const {
+        return bytes.data();
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return bytes.size();
+    }
+
+    //Only safe for the holder of the single reference. Doesn't allocate unless the buffer has never been this big
+    inline void resize(size_t size) {
+        bytes.resize(size);
+    }
+
+    //Nobody else holds a reference, so the holder may write to it again
+    [[nodiscard]] inline bool isUnique() const {
+        return refs.load(std::memory_order_acquire) == 1;
+    }
+
+    inline void retain() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+private:
+    explicit SharedBuffer(size_t size)
+        :bytes(size)
+    {}
+
+    std::atomic<int> refs = 1;
+    std::vector<char> bytes;
+};
+
+//Buffers a SharedBufferPool keeps. Each one is only held up by a connection that is a turn or more behind
+#define SHARED_BUFFER_POOL_SIZE 3
+
+/*
+ * A few buffers for data that is encoded again every turn, so a connection still sending an older one doesn't
+ * make the encoder allocate. The pool holds one reference to each buffer, a buffer is free again when that is the
+ * only one left. Only used from one thread, though the buffers are released on others.
+ */
+class SharedBufferPool {
+public:
+    SharedBufferPool() = default;
+    SharedBufferPool(const SharedBufferPool&) = delete;
+    SharedBufferPool& operator=(const SharedBufferPool&) = delete;
+
+    ~SharedBufferPool() {
+        for (SharedBuffer* buffer : buffers) {
+            if (buffer) {
+                buffer->release();
+            }
+        }
+    }
+
+    //A buffer of size bytes nobody else is reading. Stays owned by the pool, callers retain it to hand it out
+    SharedBuffer* acquire(size_t size) {
+        for (SharedBuffer* buffer : buffers) {
+            if (buffer && buffer->isUnique()) {
+                buffer->resize(size);
+                return buffer;
+            }
+        }
+
+        //Every buffer is still being sent. Take an empty slot, or give up on the one handed out longest ago
+        //(whoever is sending it frees it when done)
+        unsigned int slot = next;
+        for (unsigned int i = 0; i < SHARED_BUFFER_POOL_SIZE; i++) {
+            if (!buffers[i]) {
+                slot = i;
+                break;
+            }
+        }
+
+        if (buffers[slot]) {
+            buffers[slot]->release();
+        }
+
+        //Only the first few fills are expected. After that it means readers are too far behind for the pool
+        if (numCreated >= SHARED_BUFFER_POOL_SIZE) {
+            overflowAllocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        numCreated++;
+
+        buffers[slot] = SharedBuffer::create(size);
+        next = (slot + 1) % SHARED_BUFFER_POOL_SIZE;
+
+        return buffers[slot];
+    }
+
+    //Buffers allocated by any pool because all of its buffers were still being sent, since the program started
+    [[nodiscard]] static unsigned long long allocationsWhileFull() {
+        return overflowAllocations.load(std::memory_order_relaxed);
+    }
+private:
+    SharedBuffer* buffers[SHARED_BUFFER_POOL_SIZE] = {};
+    unsigned int next = 0;
+    unsigned int numCreated = 0;
+
+    static inline std::atomic<unsigned long long> overflowAllocations = 0;
+};
+
+#endif //SNAKE_SHAREDBUFFER_H
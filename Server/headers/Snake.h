@@ -5,19 +5,127 @@
 #ifndef SNAKE_SNAKE_H
 #define SNAKE_SNAKE_H
 
-#include <queue>
+#include <vector>
+#include <iterator>
 #include "utils.h"
 #include <iostream>
 
 class Player;
 
+/*
+ * The positions of a snake, tail first, in a ring.
+ * A snake can't be longer than the board has squares, so the ring is sized for that up front and
+ * moving, growing and iterating never allocate.
+ */
+class SnakeBody {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Pos;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Pos*;
+        using reference = const Pos&;
+
+        Iterator() = default;
+        Iterator(const SnakeBody* body, size_t index)
+            :body(body), index(index)
+        {
+
+        }
+
+        inline const Pos& operator*() const {
+            return (*body)[index];
+        }
+
+        inline const Pos* operator->() const {
+            return &(*body)[index];
+        }
+
+        inline Iterator& operator++() {
+            index++;
+            return *this;
+        }
+
+        inline Iterator operator++(int) {
+            Iterator old = *this;
+            index++;
+            return old;
+        }
+
+        inline bool operator==(const Iterator& other) const {
+            return index == other.index;
+        }
+
+    private:
+        const SnakeBody* body = nullptr;
+        size_t index = 0;
+    };
+
+    explicit SnakeBody(size_t maxLength) {
+        size_t capacity = 1;
+        while (capacity < maxLength) capacity <<= 1;
+
+        positions.resize(capacity, Pos{0, 0});
+    }
+
+    inline void push(Pos pos) {
+        positions[(tail + length) & (positions.size() - 1)] = pos;
+        length++;
+    }
+
+    inline Pos pop() {
+        Pos pos = positions[tail];
+        tail = (tail + 1) & (positions.size() - 1);
+        length--;
+        return pos;
+    }
+
+    //0 is the tail, size() - 1 the head
+    inline const Pos& operator[](size_t i) const {
+        return positions[(tail + i) & (positions.size() - 1)];
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return length;
+    }
+
+    [[nodiscard]] inline bool empty() const {
+        return length == 0;
+    }
+
+    //Keeps the capacity
+    inline void clear() {
+        tail = 0;
+        length = 0;
+    }
+
+    [[nodiscard]] inline Iterator begin() const {
+        return {this, 0};
+    }
+
+    [[nodiscard]] inline Iterator end() const {
+        return {this, length};
+    }
+
+private:
+    //Capacity is a power of two so indices wrap with a mask
+    std::vector<Pos> positions;
+    size_t tail = 0;
+    size_t length = 0;
+};
+
 class Snake {
 public:
     unsigned int startSize;
     unsigned int diedOnTurn;
     unsigned int sizeOnDeath = 0;
 
-    Snake(Player* player, unsigned int id);
+    //maxLength is the number of squares on the board
+    Snake(Player* player, unsigned int id, size_t maxLength);
+
+    //Back to an empty, alive snake for a new game, reusing the body's storage
+    void reset(Player* newPlayer);
 
     void pushPos(Pos newHead);
     [[nodiscard]] Pos retractTail();
@@ -34,7 +142,7 @@ public:
         return player;
     }
 
-    inline const std::queue<Pos>& getBody() const {
+    inline const SnakeBody& getBody() const {
         return body;
     }
 
@@ -61,10 +169,11 @@ public:
         }
     }
 private:
-    const unsigned int id;
+    //Not const so game states can be copied over each other
+    unsigned int id;
 
     Pos head = {1 << 30, 1 << 30};
-    std::queue<Pos> body;
+    SnakeBody body;
     Player* player;
     bool alive = true;
 };
@@ -0,0 +1,128 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#ifndef SNAKE_SPSCQUEUE_H
+#define SNAKE_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * Unbounded lock-free queue for exactly one producer thread and one consumer thread.
+ * Items live in fixed size chunks; drained chunks are kept as spares (up to MAX_SPARE_CHUNKS) so a queue in steady
+ * state doesn't allocate, even when the consumer falls a few chunks behind.
+ * Never blocks, so two threads feeding each other can't deadlock on a full queue.
+ */
+template<typename T, size_t CHUNK_SIZE = 256>
+class SpscQueue {
+public:
+    SpscQueue() {
+        head = tail = new Chunk();
+    }
+
+    ~SpscQueue() {
+        while (head != nullptr) {
+            Chunk* next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+        }
+
+        for (auto& spare : spares) {
+            delete spare.load(std::memory_order_relaxed);
+        }
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    //Producer only
+    void push(const T& item) {
+        if (tailIndex == CHUNK_SIZE) {
+            Chunk* chunk = nullptr;
+            for (size_t i = 0; i < MAX_SPARE_CHUNKS && chunk == nullptr; i++) {
+                chunk = spares[i].exchange(nullptr, std::memory_order_acquire);
+            }
+
+            if (chunk == nullptr) {
+                chunk = new Chunk();
+            }
+
+            tail->next.store(chunk, std::memory_order_release);
+            tail = chunk;
+            tailIndex = 0;
+        }
+
+        tail->items[tailIndex++] = item;
+        tail->written.store(tailIndex, std::memory_order_release);
+    }
+
+    //Consumer only
+    bool pop(T& out) {
+        while (true) {
+            if (headIndex < head->written.load(std::memory_order_acquire)) {
+                out = head->items[headIndex++];
+                return true;
+            }
+
+            if (headIndex < CHUNK_SIZE) {
+                return false;
+            }
+
+            Chunk* next = head->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return false;
+            }
+
+            Chunk* drained = head;
+            head = next;
+            headIndex = 0;
+
+            drained->written.store(0, std::memory_order_relaxed);
+            drained->next.store(nullptr, std::memory_order_relaxed);
+            recycle(drained);
+        }
+    }
+    //Consumer only
+    [[nodiscard]] bool empty() const {
+        if (headIndex < head->written.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        return headIndex < CHUNK_SIZE || head->next.load(std::memory_order_acquire) == nullptr;
+    }
+private:
+    static constexpr size_t MAX_SPARE_CHUNKS = 4;
+
+    struct Chunk {
+        T items[CHUNK_SIZE];
+        std::atomic<size_t> written{0};
+        std::atomic<Chunk*> next{nullptr};
+    };
+
+    //Consumer side
+    alignas(64) Chunk* head;
+    size_t headIndex = 0;
+
+    //Producer side
+    alignas(64) Chunk* tail;
+    size_t tailIndex = 0;
+
+    //Only the consumer fills a slot and only the producer empties one
+    std::atomic<Chunk*> spares[MAX_SPARE_CHUNKS] = {};
+
+    //Consumer only
+    void recycle(Chunk* chunk) {
+        for (auto& spare : spares) {
+            Chunk* empty = nullptr;
+            if (spare.compare_exchange_strong(empty, chunk, std::memory_order_release, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+
+        delete chunk;
+    }
+};
+
+
+#endif //SNAKE_SPSCQUEUE_H
@@ -0,0 +1,214 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#ifndef SNAKE_OUTPUTBUFFER_H
+#define SNAKE_OUTPUTBUFFER_H
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <sys/uio.h>
+
+#include "SharedBuffer.h"
+
+//Most parts fillParts() hands out at once. A segment takes at most 3
+#define MAX_SEND_PARTS 64
+
+/*
+ * What is waiting to go out on a connection. Packet bytes are copied into a ring, which starts small and doubles
+ * when it fills up. Shared payloads (the changes every player gets) aren't copied, a reference is queued behind
+ * the bytes that go before them and the socket reads them straight from the SharedBuffer.
+ * Nothing more than maxCapacity bytes in total may wait. A connection that would need more is not reading what we
+ * send it.
+ */
+class OutputBuffer {
+public:
+    OutputBuffer(size_t initialCapacity, size_t maxCapacity)
+        :bytes(roundUp(initialCapacity)),
+        maxCapacity(maxCapacity)
+    {
+
+    }
+
+    ~OutputBuffer() {
+        clear();
+    }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    [[nodiscard]] inline size_t size() const {
+        return length + payloadBytes;
+    }
+
+    [[nodiscard]] inline bool empty() const {
+        return size() == 0;
+    }
+
+    //Copies data and queues a reference to payload after it (the buffer takes its own).
+    //Returns false, without appending anything, if it would take the buffer over maxCapacity
+    bool append(const char* data, size_t len, SharedBuffer* payload = nullptr) {
+        if (len == 0 && !payload) return true;
+
+        size_t payloadSize = payload ? payload->size() : 0;
+
+        if (size() + len + payloadSize > maxCapacity) {
+            return false;
+        }
+
+        if (length + len > bytes.size()) {
+            grow(length + len);
+        }
+
+        size_t tail = (head + length) & (bytes.size() - 1);
+        size_t first = std::min(len, bytes.size() - tail);
+
+        memcpy(bytes.data() + tail, data, first);
+        memcpy(bytes.data(), data + first, len - first);
+
+        length += len;
+
+        //A segment is ring bytes followed by at most one payload, so bytes can join the last one until it has one
+        if (firstSegment < segments.size() && segments.back().payload == nullptr) {
+            segments.back().ringBytes += len;
+        } else {
+            segments.push_back({len, nullptr, 0});
+        }
+
+        if (payload) {
+            payload->retain();
+            segments.back().payload = payload;
+            payloadBytes += payloadSize;
+        }
+
+        return true;
+    }
+
+    //The pending bytes in order, as at most maxParts parts (at least 3). Returns how many were filled
+    int fillParts(iovec* parts, int maxParts) {
+        int numParts = 0;
+        size_t offset = 0;
+
+        for (size_t i = firstSegment; i < segments.size() && numParts + 3 <= maxParts; i++) {
+            const Segment& segment = segments[i];
+
+            if (segment.ringBytes > 0) {
+                numParts += ringParts(offset, segment.ringBytes, parts + numParts);
+                offset += segment.ringBytes;
+            }
+
+            if (segment.payload) {
+                parts[numParts++] = {segment.payload->data() + segment.payloadSent, segment.payload->size() - segment.payloadSent};
+            }
+        }
+
+        return numParts;
+    }
+
+    //Drops bytes from the front once they are sent, and the payloads that are done with
+    void consume(size_t len) {
+        while (len > 0) {
+            Segment& segment = segments[firstSegment];
+
+            size_t fromRing = std::min(len, segment.ringBytes);
+            head = (head + fromRing) & (bytes.size() - 1);
+            length -= fromRing;
+            segment.ringBytes -= fromRing;
+            len -= fromRing;
+
+            if (segment.payload) {
+                size_t fromPayload = std::min(len, segment.payload->size() - segment.payloadSent);
+                segment.payloadSent += fromPayload;
+                payloadBytes -= fromPayload;
+                len -= fromPayload;
+            }
+
+            if (segment.ringBytes > 0 || (segment.payload && segment.payloadSent < segment.payload->size())) {
+                break;
+            }
+
+            if (segment.payload) {
+                segment.payload->release();
+            }
+            firstSegment++;
+        }
+
+        if (firstSegment == segments.size()) {
+            //Keeps the next write contiguous
+            segments.clear();
+            firstSegment = 0;
+            head = 0;
+        } else if (firstSegment > segments.size() / 2) {
+            segments.erase(segments.begin(), segments.begin() + (long) firstSegment);
+            firstSegment = 0;
+        }
+    }
+
+    void clear() {
+        for (size_t i = firstSegment; i < segments.size(); i++) {
+            if (segments[i].payload) {
+                segments[i].payload->release();
+            }
+        }
+
+        segments.clear();
+        firstSegment = 0;
+        payloadBytes = 0;
+
+        head = 0;
+        length = 0;
+    }
+
+private:
+    struct Segment {
+        size_t ringBytes;
+        //Owned reference, sent from payloadSent on
+        SharedBuffer* payload;
+        size_t payloadSent;
+    };
+
+    //Capacity is a power of two so positions wrap with a mask
+    std::vector<char> bytes;
+    size_t maxCapacity;
+
+    size_t head = 0;
+    size_t length = 0;
+
+    //Sent from firstSegment on. The vector keeps its capacity, so steady traffic doesn't allocate
+    std::vector<Segment> segments;
+    size_t firstSegment = 0;
+    //Payload bytes not sent yet
+    size_t payloadBytes = 0;
+
+    //len ring bytes starting offset bytes past head, as one or two parts since they may wrap around the end
+    int ringParts(size_t offset, size_t len, iovec* parts) {
+        size_t start = (head + offset) & (bytes.size() - 1);
+        size_t first = std::min(len, bytes.size() - start);
+        parts[0] = {bytes.data() + start, first};
+
+        if (first == len) return 1;
+
+        parts[1] = {bytes.data(), len - first};
+        return 2;
+    }
+
+    static size_t roundUp(size_t n) {
+        size_t capacity = 1;
+        while (capacity < n) capacity <<= 1;
+        return capacity;
+    }
+
+    void grow(size_t needed) {
+        std::vector<char> bigger(roundUp(needed));
+
+        size_t first = std::min(length, bytes.size() - head);
+        memcpy(bigger.data(), bytes.data() + head, first);
+        memcpy(bigger.data() + first, bytes.data(), length - first);
+
+        bytes.swap(bigger);
+        head = 0;
+    }
+};
+
+#endif //SNAKE_OUTPUTBUFFER_H
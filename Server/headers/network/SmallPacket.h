@@ -0,0 +1,20 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#ifndef SNAKE_SMALLPACKET_H
+#define SNAKE_SMALLPACKET_H
+
+//Big enough for every packet except the bulk of GAME_CHANGES and WHOLE_GRID, which go in a SharedBuffer instead
+#define SMALL_PACKET_SIZE 64
+
+/*
+ * A whole packet (or the start of one) stored by value. Building one writes straight into wherever it lives,
+ * like a shard's output queue, so the per turn packets never touch the heap.
+ */
+struct SmallPacket {
+    char data[SMALL_PACKET_SIZE];
+    int len;
+};
+
+#endif //SNAKE_SMALLPACKET_H
@@ -5,21 +5,72 @@
 #ifndef SNAKE_SNAKE_NETWORK_H
 #define SNAKE_SNAKE_NETWORK_H
 
-#include <WS2tcpip.h>
 #include <vector>
 #include <memory>
 #include <map>
 #include "Player.h"
+#include "SmallPacket.h"
+#include "OutputBuffer.h"
 
 #define PORT 42069
 
+//Inward bound packets are tiny, anything bigger than this is a misbehaving client
+#define MAX_INWARD_BODY 1024
+#define RECV_BUFFER_SIZE 4096
+
+#define MAX_EPOLL_EVENTS 256
+
+//Every connection starts with this much room for unsent bytes, and grows it up to the server's max_send_buffer
+#define INITIAL_SEND_BUFFER 4096
+#define DEFAULT_MAX_SEND_BUFFER (1 << 20)
+
+//Highest protocol version the server speaks. See NAME_AND_COLOR below
+#define PROTOCOL_VERSION 2
+
+//Capabilities a client can ask for in NAME_AND_COLOR. The server answers with the ones it turned on
+#define CAP_COMPACT_CHANGES (1u << 0)
+#define CAP_MOVE_IN_CHANGES (1u << 1)
+#define CAP_TURN_TAGGED_MOVES (1u << 2)
+
+//Everything this server can turn on
+#define SERVER_CAPABILITIES (CAP_COMPACT_CHANGES | CAP_MOVE_IN_CHANGES | CAP_TURN_TAGGED_MOVES)
+
+//How many turns ahead a client with CAP_TURN_TAGGED_MOVES may send moves
+#define MAX_QUEUED_MOVES 4
+
 class GameCreator;
+class SharedBuffer;
 
 /*
  * All packet headers are 4 bytes long.
  * The first two bytes are the packet length
  * The third byte is the packet type.
  * The fourth byte is padding
+ *
+ * NAME_AND_COLOR is the color (3 bytes) then the name. Clients on a newer protocol end the name with a 0 byte and
+ * follow it with their protocol version (1 byte) and the capabilities they want (4 bytes, CAP_ bits).
+ * Clients that don't are on version 1 with no capabilities. A version 2 client that leaves out the capabilities
+ * gets CAP_COMPACT_CHANGES.
+ *
+ * CONNECTION_ESTABLISHED is empty for version 1 clients. Newer ones get the version and capabilities the server
+ * picked, in the same 5 byte layout.
+ *
+ * CAP_COMPACT_CHANGES sends GAME_CHANGES_V2 instead of GAME_CHANGES. Its 2 byte length is 0 and the real body length follows
+ * the header as 4 bytes, then the body is all varints (7 bits a byte, low bits first, top bit set on all but the last):
+ *  - our head, as the square index row * numCols + col
+ *  - the new turn
+ *  - then until the end of the body, each changed square in index order: its index minus the previous one's
+ *    (the first is the index itself), then 1 byte with 0 for empty, 1 for food and 2 + ID for a snake
+ *
+ * CAP_MOVE_IN_CHANGES sends TURN instead of the changes packet and the MOVE_REQUEST after it. It has the same 4 byte
+ * length as GAME_CHANGES_V2, then 1 byte of flags (TURN_MOVE_DUE), the turn the move is for (4 bytes) and how many
+ * milliseconds the server waits for it from when it was sent (4 bytes), then the body of whichever changes packet the
+ * client would have got otherwise. MOVE_REQUEST can still come on its own, on a turn with no changes to send.
+ *
+ * CAP_TURN_TAGGED_MOVES lets MOVE_RESPONSE carry the turn the move is for (4 bytes after the move). The turn is the
+ * one in the changes it answers. Moves for later turns (up to MAX_QUEUED_MOVES ahead) are kept until the server asks
+ * for that turn, so a client can answer before the request reaches it. Moves for turns already played are dropped.
+ * Untagged moves still count for whatever turn is being asked for.
  */
 
 enum OutwardBoundPacketType: uint8_t {
@@ -32,8 +83,16 @@ enum OutwardBoundPacketType: uint8_t {
 #endif
     SNAKE_DEAD = 5,
     GAME_RESULTS = 6,
+    GAME_CHANGES_V2 = 7,
+    TURN = 8,
 };
 
+//TURN flags
+#define TURN_MOVE_DUE (1 << 0)
+
+//The longest body the 2 byte length in the header can hold. Longer ones need a packet with the 4 byte length
+#define MAX_SHORT_PACKET_BODY 0xFFFF
+
 enum InwardBoundPacketType: uint8_t {
     NAME_AND_COLOR,
     MOVE_RESPONSE
@@ -44,33 +103,48 @@ class ConnectionManager;
 
 class Connection {
 public:
-    Connection(SOCKET i, time_t i1, ConnectionManager* manager);
+    Connection(int socket, time_t createdAt, ConnectionManager* manager, size_t maxSendBuffer);
 
-    SOCKET socket;
+    int socket;
     long long createdAt;
 
     NetworkPlayer* player = 0;
     ConnectionManager* manager;
 
-    bool removed = false;
+    //What was agreed in NAME_AND_COLOR: the client's version (at most PROTOCOL_VERSION), and the capabilities
+    //it asked for that the server has
+    uint8_t protocolVersion = 1;
+    uint32_t capabilities = 0;
 
-    //Allow for receiving partial packets
-    enum CurrState {
-        AWAITING_HEADER, AWAITING_BODY, COMPLETE
-    };
+    bool removed = false;
+    //The client stopped reading or the socket broke while sending. The manager drops it at the end of its tick
+    bool failed = false;
 
-    CurrState currState = AWAITING_HEADER;
-    char header[4];
-    int headerReceived = 0;
-    char body[1024];
-    int bodyLength = 0;
-    int bodyReceived = 0;
+    //Allow for receiving partial packets. Bytes are read in bulk and packets are parsed out of the buffer
+    char recvBuffer[RECV_BUFFER_SIZE];
+    int recvLength = 0;
 
+    //Called when epoll says the socket is readable. Drains it since we are edge-triggered.
     //Returns false if the connection should be destroyed
-    bool tick();
+    bool onReadable();
 
-    void sendData(const char* data, int len);
+    //Bytes the socket didn't take yet. Flushed again when epoll says it is writable
+    OutputBuffer sendBuffer;
+
+    //Set while the connection is in the manager's pendingFlush list
+    bool flushQueued = false;
+
+    //payload is sent straight after data, without being copied. The caller keeps its reference.
+    //Only queues the bytes, the manager flushes every connection once per tick so everything a player gets in a
+    //turn goes out in one syscall
+    void sendData(const char* data, int len, SharedBuffer* payload = nullptr);
+    //Sends as much of sendBuffer as the socket takes. Returns false if the connection should be destroyed
+    bool flush();
     bool handle(char packetType, const char* data, int len);
+
+private:
+    //What follows the 0 after the name in NAME_AND_COLOR
+    void readHandshakeExtension(const char* data, int len);
 };
 
 class NetworkPlayer: public Player {
@@ -79,13 +153,42 @@ public:
 
     NetworkPlayer(std::string name, Color color, Connection* c);
 
-    void receiveMove(Move move);
+    void receiveMove(Move move, std::optional<unsigned int> turn) override;
 
 private:
     std::optional<Move> receivedMove;
+
+    //The turn the game last asked a move for. Tagged moves are checked against it
+    std::optional<unsigned int> askedTurn;
+
+    //Tagged moves for turns that haven't been asked for yet, in turn order
+    struct QueuedMove {
+        unsigned int turn;
+        Move move;
+    };
+    QueuedMove queuedMoves[MAX_QUEUED_MOVES];
+    unsigned int numQueuedMoves = 0;
+
+    void queueMove(unsigned int turn, Move move);
+    void sendMoveRequest(Game& game, Snake& snake);
+
+    //With CAP_MOVE_IN_CHANGES, the turn's changes wait here for the move request so both go out in one TURN
+    Changes* heldChanges = nullptr;
+
+    //Takes one reference to the payload
+    void send(const SmallPacket& packet, SharedBuffer* payload = nullptr);
+
+    //The part of the changes that is the same for everyone, in this connection's format. Returns a new reference
+    SharedBuffer* changesPayload(Game& game, Changes& changes);
+    void sendTurn(Game& game, Snake& snake, Changes& changes, bool moveDue);
+    //Held changes go out on their own if something else has to be sent first
+    void releaseHeldChanges(Game& game, Snake& snake);
+    //Kicks the player and closes the connection on the main thread, for when it can't be sent what it needs.
+    //The snake then times out like any player that disconnected
+    void drop(const std::string& reason);
 public:
 protected:
-    void onDeath(Game &game, Snake &snake, std::string reason, bool timeout) override;
+    void onDeath(Game &game, Snake &snake, const std::string& reason, bool timeout) override;
 
 public:
     void
@@ -107,28 +210,52 @@ protected:
 
 class ConnectionManager {
 public:
-    ConnectionManager(const char* ip, GameCreator* creator);
+    ConnectionManager(const char* ip, GameCreator* creator, size_t maxSendBuffer = DEFAULT_MAX_SEND_BUFFER);
     ~ConnectionManager();
 
-    void tick();
+    //Waits up to timeoutMs for network activity, then handles everything that is ready
+    void tick(int timeoutMs = 0);
+
+    //Interrupts a tick() that is waiting. Safe to call from any thread
+    void wakeUp();
 
     std::vector<Connection*> connections;
-    fd_set allConnections;
-    std::map<SOCKET, Connection*> connectionMap;
+    std::map<int, Connection*> connectionMap;
+    //Connections that have had data queued since the last flush
+    std::vector<Connection*> pendingFlush;
     GameCreator* creator;
 private:
-    SOCKET serverSocket;
-    fd_set listener;
+    int serverSocket;
+    int epollFd;
+    int wakeFd;
+
+    size_t maxSendBuffer;
+
+    void acceptConnections();
+    void flushPending();
+    //Drops connections that never sent NAME_AND_COLOR, and ones that failed while sending
+    void dropBadConnections();
 
     void handleDeadConnection(Connection *conn);
 };
 
-char* makeConnectionEstablishedPacket(int& len);
-char* makeMoveRequestPacket(int& len);
-char* makeGameChangesPacket(int& len, Game& game, Snake& snake, Changes& changes);
-char* makeGameStartPacket(int& len, Game& game, Snake& snake);
-char* makeWholeGridPacket(int& len, Game& game);
-char* makeSnakeDeadPacket(int& len, std::string& reason);
-char* makeGameResultsPacket(int& len, bool died, unsigned int length, int score, unsigned int diedOn, unsigned int rank, unsigned int numTies, int newElo);
+//Packets are built in place into these, so building one never allocates
+void makeConnectionEstablishedPacket(SmallPacket& packet, uint8_t protocolVersion, uint32_t capabilities);
+void makeMoveRequestPacket(SmallPacket& packet);
+//GAME_CHANGES is split so the changes can be encoded once per turn and shared between players
+void encodeGameChangesPayload(Changes& changes);
+//Returns false if the changes are too long for the 2 byte length, which only compact changes get around
+bool makeGameChangesHeader(SmallPacket& packet, Snake& snake, SharedBuffer* payload);
+//The same for GAME_CHANGES_V2. numCols turns positions into square indices
+void encodeCompactChangesPayload(Changes& changes, unsigned int numCols);
+void makeCompactChangesHeader(SmallPacket& packet, Game& game, Snake& snake, SharedBuffer* payload);
+void makeTurnHeader(SmallPacket& packet, Game& game, Snake& snake, bool compact, uint8_t flags, unsigned int turn,
+                    uint32_t deadlineMs, SharedBuffer* payload);
+void makeGameStartPacket(SmallPacket& packet, Game& game, Snake& snake);
+#ifdef _DEBUG
+SharedBuffer* makeWholeGridPacket(Game& game);
+#endif
+void makeSnakeDeadPacket(SmallPacket& packet, const std::string& reason);
+void makeGameResultsPacket(SmallPacket& packet, bool died, unsigned int length, int score, unsigned int diedOn, unsigned int rank, unsigned int numTies, int newElo);
 
 #endif //SNAKE_SNAKE_NETWORK_H
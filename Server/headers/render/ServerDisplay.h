@@ -0,0 +1,32 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#ifndef SNAKE_SERVERDISPLAY_H
+#define SNAKE_SERVERDISPLAY_H
+
+#include <vector>
+#include "GameDisplay.h"
+
+class GameCreator;
+
+//Everything the windowed server draws. Kept out of GameCreator so the headless build doesn't need ImGui
+class ServerDisplay {
+public:
+    ServerDisplay(GameCreator* creator, unsigned int numDisplays);
+
+    void render();
+private:
+    GameCreator* creator;
+    std::vector<GameDisplay> displays;
+
+    //Config state
+    char fileBuf[64];
+
+    void assignGames();
+    void renderLeaderboard();
+    void renderOptions();
+};
+
+
+#endif //SNAKE_SERVERDISPLAY_H
@@ -0,0 +1,44 @@
+/*
+ * C interface to BatchEnv, for loading the rules from Python (ctypes/cffi) or anything else with a C FFI.
+ * See BatchEnv.h for how the buffers are laid out. Every buffer belongs to the caller.
+ */
+
+#ifndef SNAKE_SNAKE_ENV_H
+#define SNAKE_SNAKE_ENV_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#define SNAKE_ENV_API __declspec(dllexport)
+#else
+#define SNAKE_ENV_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SnakeBatch SnakeBatch;
+
+/* Returns NULL (and prints why) if the layout can't be loaded. max_turns of 0 means no limit */
+SNAKE_ENV_API SnakeBatch* snake_batch_create(const char* layout_path, uint32_t num_envs, uint64_t seed, uint32_t max_turns);
+SNAKE_ENV_API void snake_batch_destroy(SnakeBatch* batch);
+
+SNAKE_ENV_API uint32_t snake_batch_num_envs(const SnakeBatch* batch);
+SNAKE_ENV_API uint32_t snake_batch_num_snakes(const SnakeBatch* batch);
+SNAKE_ENV_API uint32_t snake_batch_num_rows(const SnakeBatch* batch);
+SNAKE_ENV_API uint32_t snake_batch_num_cols(const SnakeBatch* batch);
+
+/* Any buffer may be NULL, its output is then skipped. Every game exists from creation, so step works before reset */
+SNAKE_ENV_API void snake_batch_set_buffers(SnakeBatch* batch, uint8_t* observations, float* rewards, uint8_t* dones,
+                                           uint8_t* alive, uint32_t* heads);
+
+SNAKE_ENV_API void snake_batch_reset(SnakeBatch* batch);
+/* num_envs * num_snakes moves, 0 up, 1 right, 2 down, 3 left */
+SNAKE_ENV_API void snake_batch_step(SnakeBatch* batch, const uint8_t* moves);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SNAKE_SNAKE_ENV_H
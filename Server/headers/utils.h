@@ -7,11 +7,74 @@
 
 #include <cstdint>
 #include <random>
+#include <vector>
+#include <utility>
 #include <cassert>
 
 #define MIN_T(a, b) ((a) < (b) ? (a) : (b))
 
-static std::mt19937 rng(std::random_device{}());
+//Per thread, games on different shards use it at the same time.
+//Only for things outside the rules (dummy moves, colors, matchmaking), games use their own GameRng
+static thread_local std::mt19937 rng(std::random_device{}());
+
+/*
+ * xoshiro256** seeded through splitmix64. Games own one so everything random in a game follows from its seed.
+ * Bounded numbers and shuffles are done here rather than with <random>'s distributions, whose output
+ * differs between standard libraries.
+ */
+class GameRng {
+public:
+    explicit GameRng(uint64_t seed) {
+        for (uint64_t& word : state) {
+            seed += 0x9e3779b97f4a7c15ull;
+
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    //A seed for a new game, from the system
+    static uint64_t randomSeed() {
+        std::random_device device;
+        return ((uint64_t) device() << 32) | device();
+    }
+
+    inline uint64_t next() {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+
+        return result;
+    }
+
+    //In [0, n). Multiply and shift, the bias is far too small to matter for a board
+    inline uint32_t below(uint32_t n) {
+        return (uint32_t) (((next() >> 32) * n) >> 32);
+    }
+
+    template<typename T>
+    void shuffle(std::vector<T>& items) {
+        for (size_t i = items.size(); i > 1; i--) {
+            std::swap(items[i - 1], items[below(i)]);
+        }
+    }
+
+private:
+    uint64_t state[4];
+
+    static inline uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
 
 struct Color {
     uint8_t r, g, b;
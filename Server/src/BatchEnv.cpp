@@ -0,0 +1,112 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#include "BatchEnv.h"
+
+BatchEnv::BatchEnv(const GameConfig& config, unsigned int numEnvs, uint64_t seed, unsigned int maxTurns)
+    :config(config),
+    maxTurns(maxTurns),
+    seeds(seed),
+    noPlayers(config.snakes.size(), nullptr)
+{
+    //Created up front so step() works before the first reset(), and reset in place after that
+    this->envs.reserve(numEnvs);
+
+    for (unsigned int env = 0; env < numEnvs; env++) {
+        this->envs.emplace_back(this->config, this->noPlayers, this->seeds.next(), false);
+    }
+
+    this->moveScratch.resize(config.snakes.size(), UP);
+    this->sizesBefore.resize(config.snakes.size(), 0);
+}
+
+void BatchEnv::setBuffers(const Buffers& buffers) {
+    this->buffers = buffers;
+}
+
+void BatchEnv::reset() {
+    for (unsigned int env = 0; env < this->envs.size(); env++) {
+        resetEnv(env);
+
+        if (this->buffers.dones) {
+            this->buffers.dones[env] = 0;
+        }
+    }
+}
+
+void BatchEnv::resetEnv(unsigned int env) {
+    this->envs[env].reset(this->config, this->noPlayers, this->seeds.next());
+    writeObservation(env);
+}
+
+void BatchEnv::step(const uint8_t* moves) {
+    unsigned int numSnakes = this->numSnakes();
+
+    for (unsigned int env = 0; env < this->envs.size(); env++) {
+        GameState& state = this->envs[env];
+        const std::vector<Snake>& snakes = state.getSnakes();
+
+        const uint8_t* envMoves = moves + (size_t) env * numSnakes;
+
+        for (unsigned int i = 0; i < numSnakes; i++) {
+            this->moveScratch[i] = (Move) (envMoves[i] & 3);
+            this->sizesBefore[i] = snakes[i].getSize();
+        }
+
+        state.clearDeaths();
+        state.step(this->moveScratch.data());
+
+        if (this->buffers.rewards) {
+            float* rewards = this->buffers.rewards + (size_t) env * numSnakes;
+
+            for (unsigned int i = 0; i < numSnakes; i++) {
+                rewards[i] = snakes[i].isAlive() ? (float) snakes[i].getSize() - this->sizesBefore[i] : 0.f;
+            }
+
+            for (const GameState::Death& death : state.getDeaths()) {
+                rewards[death.snake] = -1.f;
+            }
+        }
+
+        bool done = state.hasGameEnded() || (this->maxTurns > 0 && state.getTurn() >= this->maxTurns);
+
+        if (this->buffers.dones) {
+            this->buffers.dones[env] = done;
+        }
+
+        if (done) {
+            resetEnv(env);
+        } else {
+            writeObservation(env);
+        }
+    }
+}
+
+void BatchEnv::writeObservation(unsigned int env) {
+    const GameState& state = this->envs[env];
+    unsigned int numSnakes = this->numSnakes();
+
+    if (this->buffers.observations) {
+        state.copyBoard(this->buffers.observations + (size_t) env * this->config.numRows * this->config.numCols);
+    }
+
+    const std::vector<Snake>& snakes = state.getSnakes();
+
+    if (this->buffers.alive) {
+        uint8_t* alive = this->buffers.alive + (size_t) env * numSnakes;
+
+        for (unsigned int i = 0; i < numSnakes; i++) {
+            alive[i] = snakes[i].isAlive();
+        }
+    }
+
+    if (this->buffers.heads) {
+        uint32_t* heads = this->buffers.heads + (size_t) env * numSnakes * 2;
+
+        for (unsigned int i = 0; i < numSnakes; i++) {
+            heads[i * 2] = snakes[i].getHead().row;
+            heads[i * 2 + 1] = snakes[i].getHead().col;
+        }
+    }
+}
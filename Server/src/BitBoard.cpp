@@ -0,0 +1,265 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#include "../headers/BitBoard.h"
+#include <algorithm>
+#include <bit>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SNAKE_SPREAD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SNAKE_SPREAD_SSE2
+#endif
+
+//Kernels step 4 words at a time at most
+static constexpr unsigned int WORD_GROUP = 4;
+
+BitBoard::BitBoard(unsigned int numSquares, unsigned int stride)
+    :stride(stride)
+{
+    //Enough to read a row and a word past either end
+    this->pad = stride / 64 + 2;
+    this->numWords = ((numSquares + 63) / 64 + WORD_GROUP - 1) / WORD_GROUP * WORD_GROUP;
+    this->data.resize(this->pad * 2 + this->numWords, 0);
+}
+
+void BitBoard::clear() {
+    std::fill(this->data.begin(), this->data.end(), 0);
+}
+
+unsigned int BitBoard::count() const {
+    unsigned int total = 0;
+    const uint64_t* w = this->words();
+
+    for (unsigned int i = 0; i < this->numWords; i++) {
+        total += std::popcount(w[i]);
+    }
+
+    return total;
+}
+
+/*
+ * dst = every square next to one in src that is open and not visited yet. Returns whether dst has anything in it.
+ * A square's left neighbour is the bit below it and the one above is stride bits below, so the four directions
+ * are shifts of the whole board by 1 and by stride. The wall ring is never open, so nothing wraps between rows.
+ */
+#if defined(SNAKE_SPREAD_AVX2)
+
+static bool spread(const uint64_t* src, const uint64_t* open, const uint64_t* visited, uint64_t* dst,
+                   unsigned int numWords, unsigned int stride) {
+    unsigned int q = stride / 64;
+    //A shift by 64 gives 0 here, so a stride that is a multiple of 64 needs no special case
+    __m128i r = _mm_cvtsi32_si128((int) (stride % 64));
+    __m128i rInv = _mm_cvtsi32_si128((int) (64 - stride % 64));
+
+    __m256i any = _mm256_setzero_si256();
+
+    for (unsigned int i = 0; i < numWords; i += 4) {
+        __m256i center = _mm256_loadu_si256((const __m256i*) (src + i));
+
+        __m256i fromLeft = _mm256_or_si256(_mm256_slli_epi64(center, 1),
+                                           _mm256_srli_epi64(_mm256_loadu_si256((const __m256i*) (src + i - 1)), 63));
+        __m256i fromRight = _mm256_or_si256(_mm256_srli_epi64(center, 1),
+                                            _mm256_slli_epi64(_mm256_loadu_si256((const __m256i*) (src + i + 1)), 63));
+        __m256i fromAbove = _mm256_or_si256(_mm256_sll_epi64(_mm256_loadu_si256((const __m256i*) (src + i - q)), r),
+                                            _mm256_srl_epi64(_mm256_loadu_si256((const __m256i*) (src + i - q - 1)), rInv));
+        __m256i fromBelow = _mm256_or_si256(_mm256_srl_epi64(_mm256_loadu_si256((const __m256i*) (src + i + q)), r),
+                                            _mm256_sll_epi64(_mm256_loadu_si256((const __m256i*) (src + i + q + 1)), rInv));
+
+        __m256i reached = _mm256_or_si256(_mm256_or_si256(fromLeft, fromRight), _mm256_or_si256(fromAbove, fromBelow));
+        reached = _mm256_and_si256(reached, _mm256_loadu_si256((const __m256i*) (open + i)));
+        reached = _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*) (visited + i)), reached);
+
+        _mm256_storeu_si256((__m256i*) (dst + i), reached);
+        any = _mm256_or_si256(any, reached);
+    }
+
+    return !_mm256_testz_si256(any, any);
+}
+
+const char* SpaceSearch::kernelName() {
+    return "AVX2";
+}
+
+#elif defined(SNAKE_SPREAD_SSE2)
+
+static bool spread(const uint64_t* src, const uint64_t* open, const uint64_t* visited, uint64_t* dst,
+                   unsigned int numWords, unsigned int stride) {
+    unsigned int q = stride / 64;
+    //A shift by 64 gives 0 here, so a stride that is a multiple of 64 needs no special case
+    __m128i r = _mm_cvtsi32_si128((int) (stride % 64));
+    __m128i rInv = _mm_cvtsi32_si128((int) (64 - stride % 64));
+
+    __m128i any = _mm_setzero_si128();
+
+    for (unsigned int i = 0; i < numWords; i += 2) {
+        __m128i center = _mm_loadu_si128((const __m128i*) (src + i));
+
+        __m128i fromLeft = _mm_or_si128(_mm_slli_epi64(center, 1),
+                                        _mm_srli_epi64(_mm_loadu_si128((const __m128i*) (src + i - 1)), 63));
+        __m128i fromRight = _mm_or_si128(_mm_srli_epi64(center, 1),
+                                         _mm_slli_epi64(_mm_loadu_si128((const __m128i*) (src + i + 1)), 63));
+        __m128i fromAbove = _mm_or_si128(_mm_sll_epi64(_mm_loadu_si128((const __m128i*) (src + i - q)), r),
+                                         _mm_srl_epi64(_mm_loadu_si128((const __m128i*) (src + i - q - 1)), rInv));
+        __m128i fromBelow = _mm_or_si128(_mm_srl_epi64(_mm_loadu_si128((const __m128i*) (src + i + q)), r),
+                                         _mm_sll_epi64(_mm_loadu_si128((const __m128i*) (src + i + q + 1)), rInv));
+
+        __m128i reached = _mm_or_si128(_mm_or_si128(fromLeft, fromRight), _mm_or_si128(fromAbove, fromBelow));
+        reached = _mm_and_si128(reached, _mm_loadu_si128((const __m128i*) (open + i)));
+        reached = _mm_andnot_si128(_mm_loadu_si128((const __m128i*) (visited + i)), reached);
+
+        _mm_storeu_si128((__m128i*) (dst + i), reached);
+        any = _mm_or_si128(any, reached);
+    }
+
+    //No ptest before SSE4.1
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF;
+}
+
+const char* SpaceSearch::kernelName() {
+    return "SSE2";
+}
+
+#else
+
+static bool spread(const uint64_t* src, const uint64_t* open, const uint64_t* visited, uint64_t* dst,
+                   unsigned int numWords, unsigned int stride) {
+    unsigned int q = stride / 64;
+    unsigned int r = stride % 64;
+
+    //Offset pointers rather than src[i - q], which would wrap around as unsigned before reaching the padding
+    const uint64_t* before = src - 1;
+    const uint64_t* after = src + 1;
+    const uint64_t* above = src - q;
+    const uint64_t* aboveBefore = src - q - 1;
+    const uint64_t* below = src + q;
+    const uint64_t* belowAfter = src + q + 1;
+
+    uint64_t any = 0;
+
+    for (unsigned int i = 0; i < numWords; i++) {
+        uint64_t fromLeft = (src[i] << 1) | (before[i] >> 63);
+        uint64_t fromRight = (src[i] >> 1) | (after[i] << 63);
+        //Shifting a 64-bit word by 64 is undefined
+        uint64_t fromAbove = r ? (above[i] << r) | (aboveBefore[i] >> (64 - r)) : above[i];
+        uint64_t fromBelow = r ? (below[i] >> r) | (belowAfter[i] << (64 - r)) : below[i];
+
+        dst[i] = (fromLeft | fromRight | fromAbove | fromBelow) & open[i] & ~visited[i];
+        any |= dst[i];
+    }
+
+    return any != 0;
+}
+
+const char* SpaceSearch::kernelName() {
+    return "scalar";
+}
+
+#endif
+
+SpaceSearch::SpaceSearch(unsigned int numSquares, unsigned int stride)
+    :numSquares(numSquares),
+    stride(stride),
+    visited(numSquares, stride),
+    contested(numSquares, stride)
+{
+    ensureHeads(1);
+}
+
+void SpaceSearch::ensureHeads(unsigned int numHeads) {
+    while (this->frontiers.size() < numHeads) {
+        this->frontiers.emplace_back(this->numSquares, this->stride);
+        this->next.emplace_back(this->numSquares, this->stride);
+    }
+}
+
+unsigned int SpaceSearch::reachable(const BitBoard& open, unsigned int start, unsigned int limit) {
+    unsigned int numWords = this->visited.getNumWords();
+
+    BitBoard* frontier = &this->frontiers[0];
+    BitBoard* reached = &this->next[0];
+
+    this->visited.clear();
+    frontier->clear();
+    this->visited.set(start);
+    frontier->set(start);
+
+    unsigned int area = 0;
+
+    while (area < limit && spread(frontier->words(), open.words(), this->visited.words(), reached->words(), numWords, this->stride)) {
+        uint64_t* v = this->visited.words();
+        const uint64_t* n = reached->words();
+
+        for (unsigned int i = 0; i < numWords; i++) {
+            v[i] |= n[i];
+            area += std::popcount(n[i]);
+        }
+
+        std::swap(frontier, reached);
+    }
+
+    return area;
+}
+
+void SpaceSearch::partition(const BitBoard& open, const unsigned int* heads, unsigned int numHeads, unsigned int* owned,
+                            unsigned int maxDepth) {
+    ensureHeads(numHeads);
+
+    unsigned int numWords = this->visited.getNumWords();
+
+    this->visited.clear();
+
+    for (unsigned int h = 0; h < numHeads; h++) {
+        this->frontiers[h].clear();
+        this->frontiers[h].set(heads[h]);
+        this->visited.set(heads[h]);
+        owned[h] = 0;
+    }
+
+    bool growing = true;
+
+    for (unsigned int depth = 0; growing && depth < maxDepth; depth++) {
+        growing = false;
+
+        //Everything is spread from the same visited board, so heads that get somewhere on the same turn both see it
+        for (unsigned int h = 0; h < numHeads; h++) {
+            if (spread(this->frontiers[h].words(), open.words(), this->visited.words(), this->next[h].words(), numWords, this->stride)) {
+                growing = true;
+            }
+        }
+
+        if (!growing) break;
+
+        uint64_t* c = this->contested.words();
+        uint64_t* v = this->visited.words();
+
+        for (unsigned int i = 0; i < numWords; i++) {
+            uint64_t seenWord = 0;
+            uint64_t contestedWord = 0;
+
+            for (unsigned int h = 0; h < numHeads; h++) {
+                uint64_t word = this->next[h].words()[i];
+
+                contestedWord |= seenWord & word;
+                seenWord |= word;
+            }
+
+            c[i] = contestedWord;
+            v[i] |= seenWord;
+        }
+
+        for (unsigned int h = 0; h < numHeads; h++) {
+            uint64_t* n = this->next[h].words();
+
+            for (unsigned int i = 0; i < numWords; i++) {
+                n[i] &= ~c[i];
+                owned[h] += std::popcount(n[i]);
+            }
+
+            std::swap(this->frontiers[h], this->next[h]);
+        }
+    }
+}
@@ -7,6 +7,7 @@
 #include "../headers/Game.h"
 
 #include <iostream>
+#include <algorithm>
 
 DummyPlayer::DummyPlayer(std::string name, Color color)
         :Player(color, name)
@@ -30,18 +31,14 @@ void DummyPlayer::prepareNextMove(Game &game, Snake& snake) {
         this->savedMove = std::optional<Move>(moves[0]);
     }
 
+    moveReady();
 }
 
 bool DummyPlayer::isMoveSafe(Move move, Game &game, Snake &snake) {
-    Pos newHead = snake.getHead() + move;
-
-    if (!game.isWithinBounds(newHead)) {
-        return false;
-    }
-
-    return game.getSquare(newHead).canMoveTo();
+    //Off the board is a wall, so no bounds check needed
+    return game.getCell(snake.getHead() + move).canMoveTo();
 }
 
-void DummyPlayer::onDeath(Game &game, Snake &snake, std::string reason, bool timeout) {
+void DummyPlayer::onDeath(Game &game, Snake &snake, const std::string& reason, bool timeout) {
     std::cout << this->getName() << " died. Reason: " << reason << std::endl;
 }
@@ -3,504 +3,268 @@
 //
 
 #include "../headers/Game.h"
+#include "../headers/SharedBuffer.h"
+#include "../headers/Replay.h"
 #include <iostream>
 #include <chrono>
 #include <cassert>
 #include <map>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
 
-#include <json/json.hpp>
-#include <fstream>
+static std::atomic<unsigned long long> nextGameSerial = 0;
+static std::atomic<unsigned long long> totalTurnsPlayed = 0;
 
-// Multiplayer ELO is based on https://towardsdatascience.com/developing-a-generalized-elo-rating-system-for-multiplayer-games-b9b495e87802
-
-static Move getMove(std::string basicString);
+unsigned long long Game::turnsPlayed() {
+    return totalTurnsPlayed.load(std::memory_order_relaxed);
+}
 
-Game::Game(GameConfig& config, std::vector<Player*>& players)
-        :numRows(config.numRows),
-        numCols(config.numCols),
-        numFood(config.numFood)
+Game::Game(GameConfig& config, std::vector<Player*>& players, uint64_t seed, const Pacing& pacing,
+           GameScheduler* scheduler)
+        :GameState(config, players, seed, true),
+        serial(nextGameSerial++),
+        scheduler(scheduler),
+        replay(std::make_unique<Replay>()),
+        pacing(pacing),
+        moveTimeoutMs(pacing.timeoutMs)
 {
-    this->grid = new Square[numRows * numCols];
-
-    for (int i = 0; i < numRows * numCols; i++) {
-        this->grid[i].type = SquareType::EMPTY;
-    }
-
     for (Player* player: players) {
         assert(!player->inGame);
         player->inGame = true;
     }
 
-    //Shuffle players
-    std::shuffle(players.begin(), players.end(), rng);
-
-    if (players.size() != config.snakes.size()) {
-        std::cerr << "Number of players does not match number of snakes" << std::endl;
-    }
-
-    for (unsigned int i = 0; i < MIN_T(players.size(), config.snakes.size()); i++) {
-        this->snakes.emplace_back(Snake{players[i], i});
-        Snake& snake = this->snakes.back();
-
-        Pos p = config.snakes[i].back;
-        this->setSquare(p, Square::snake(i));
-        snake.pushPos(p);
+    std::cout << "Starting game " << this->serial << " with seed " << seed << " (" << pacingModeName(pacing.mode)
+              << " pacing)" << std::endl;
 
-        for (Move move : config.snakes[i].body) {
-            p = p + move;
-            this->setSquare(p, Square::snake(i));
+    this->replay->serial = this->serial;
+    this->replay->seed = seed;
+    this->replay->startTime = time(nullptr);
+    this->replay->config = config;
 
-            snake.pushPos(p);
-        }
-
-        snake.startSize = snake.getBody().size();
+    for (Snake& snake : this->snakes) {
+        Player* player = snake.getPlayer();
+        this->replay->players.push_back({player->getName(), player->getColor(), player->getElo()});
     }
 
-    updateFood();
+    this->turnMoves.resize(this->snakes.size(), UP);
+
+    //Everything a turn adds to is sized up front, so turns don't allocate
+    this->replay->moves.reserve(this->snakes.size() * REPLAY_RESERVE_TURNS / 4);
+    this->changesToBroadcast.changes.reserve(this->grid.size());
 
     for (Snake& snake : this->snakes) {
         snake.getPlayer()->beginGame(*this, snake);
     }
 
-    //Calculate expected scores
-    for (Snake& snake: this->snakes) {
-        int currScore = snake.getPlayer()->getElo();
-        float total = 0;
-
-        for (Snake& otherSnake: this->snakes) {
-            if (snake.getID() == otherSnake.getID()) {
-                continue;
-            }
-
-            total += 1.0f / (1.f + std::pow(10.f, (otherSnake.getPlayer()->getElo() - currScore) / ELO_D));
-        }
-
-        total /= this->snakes.size() * (this->snakes.size() - 1) / 2;
-
-        this->expectedScores[&snake] = total;
+    if (this->scheduler) {
+        this->scheduler->add(this);
     }
 
     pushChanges();
     requestMoves();
 }
 
-Game::~Game() {
-    delete[] this->grid;
-}
-
-Square Game::getSquare(Pos pos) const {
-    return this->grid[this->idx(pos)];
-}
-
-Square Game::setSquare(Pos pos, Square value) {
-    Square old = this->grid[this->idx(pos)];
-    this->grid[this->idx(pos)] = value;
-    this->changes.insert(pos);
-
-    return old;
-}
-
-void Game::updateFood() {
-    int currentFoodN = 0;
-    std::vector<Pos> empty;
-
-    for (unsigned int row = 0; row < this->numRows; row++) {
-        for (unsigned int col = 0; col < this->numCols; col++) {
-            Pos pos = {row, col};
-            if (this->getSquare(pos).type == SquareType::FOOD) {
-                currentFoodN++;
-            } else if (this->getSquare(pos).type == SquareType::EMPTY) {
-                empty.push_back(pos);
-            }
-        }
-    }
-
-    if (currentFoodN < this->numFood) {
-        if (currentFoodN == this->numFood - 1) {
-            this->setSquare(empty[rng() % empty.size()], Square::food());
-        } else {
-            std::shuffle(empty.begin(), empty.end(), rng);
-
-            for (int i = 0; i < this->numFood - currentFoodN; i++) {
-                this->setSquare(empty[i], Square::food());
-            }
-        }
-    }
-}
+//Out of line for the Replay, the changes buffers are released by their pools
+Game::~Game() = default;
 
 void Game::requestMoves() {
+    //Before asking, players with CAP_MOVE_IN_CHANGES are told the deadline
+    this->moveTimeoutMs = nextMoveTimeoutMs();
+
+    //Counted up front, players may answer straight away
+    this->movesPending = 0;
     for (Snake& snake : this->snakes) {
         if (snake.isAlive()) {
-            snake.getPlayer()->askForNextMove(*this, snake);
+            this->movesPending++;
         }
     }
 
-    using namespace std::chrono;
-    this->lastMoveAsk = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-}
-
-void Game::pushChanges() {
-    Changes changesToBroadcast;
-
-    for (Pos pos : this->changes) {
-        changesToBroadcast.changes.insert({pos, this->getSquare(pos)});
-    }
-
-    changesToBroadcast.newTurn = this->currTurn;
-
+    this->askingForMoves = true;
     for (Snake& snake : this->snakes) {
         if (snake.isAlive()) {
-            snake.getPlayer()->receiveChanges(*this, snake, changesToBroadcast);
+            snake.getPlayer()->askForNextMove(*this, snake);
         }
     }
-}
-
-void Game::tryTick() {
-    if (!canTick()) {
-        return;
-    }
+    this->askingForMoves = false;
 
-    bool receivedAllMoves = true;
-
-    std::set<Snake*> deadSnakes;
+    //Built-in bots have already answered while being asked. The clock only starts now, because network players
+    //don't get their turn until the shard is done with this, so the bots' thinking time doesn't come out of theirs
+    this->lastMoveAsk = GameClock::now();
 
     for (Snake& snake : this->snakes) {
-        if (snake.isAlive() && !snake.getPlayer()->nextMove().has_value()) {
-            receivedAllMoves = false;
-            deadSnakes.insert(&snake);
+        if (snake.isAlive()) {
+            snake.getPlayer()->restartMoveClock(this->lastMoveAsk);
         }
     }
 
-    if (receivedAllMoves || isTimeout()) {
-        this->snakesDeadThisTurn.clear();
-
-        for (Snake* snake: deadSnakes) {
-            snake->sizeOnDeath = snake->getSize();
-            killSnake(snake, std::string("Didn't receive move after ") + std::to_string(TIMEOUT_MS) + "ms", true);
-        }
-
-        tick();
+    if (this->scheduler) {
+        unsigned int waitMs = this->movesPending == 0 ? minTurnMs() : this->moveTimeoutMs;
+        this->scheduler->schedule(this, this->lastMoveAsk + std::chrono::milliseconds(waitMs));
     }
 }
 
-void Game::tick() {
-    std::map<Pos, std::vector<Snake*>> targets;
-
-    for (Snake& snake : this->snakes) {
-        if (snake.isAlive()) {
-            assert(snake.getPlayer()->nextMove().has_value());
+void Game::onMoveReady() {
+    assert(this->movesPending > 0);
 
-            Move move = snake.getPlayer()->nextMove().value();
-            targets[snake.getHead() + move].push_back(&snake);
-        }
+    //requestMoves() schedules the game itself once everyone has been asked
+    if (--this->movesPending == 0 && this->scheduler && !this->askingForMoves) {
+        this->scheduler->schedule(this, this->lastMoveAsk + std::chrono::milliseconds(minTurnMs()));
     }
-
-    for (auto entry: targets) {
-        if (entry.second.size() > 1) {
-            for (Snake* snake : entry.second) {
-                snake->sizeOnDeath = snake->getSize();
-                killSnake(snake, "Collision with other snake's head", false);
-            }
-        } else {
-            Snake* snake = entry.second[0];
-            if (!isWithinBounds(entry.first)) {
-                this->setSquare(snake->retractTail(), Square::empty());
-            } else if (this->getSquare(entry.first).type != SquareType::FOOD) {
-                this->setSquare(snake->retractTail(), Square::empty());
-            }
-        }
-    }
-
-    for (auto entry: targets) {
-        if (entry.second.size() == 1) {
-            Snake* snake = entry.second[0];
-            Pos target = entry.first;
-
-            if (!isWithinBounds(target)) {
-                snake->sizeOnDeath = snake->getSize() + 1; //We retracted the tail but it's length is still one more
-                killSnake(snake, "Out of bounds", false);
-                continue;
-            }
-
-            Square square = this->getSquare(target);
-
-            if (!square.canMoveTo()) {
-                if (square.snakeID == snake->getID()) {
-                    snake->sizeOnDeath = snake->getSize() + 1; //We retracted the tail but it's length is still one more
-                    killSnake(snake, "Tried to move to own body", false);
-                } else {
-                    snake->sizeOnDeath = snake->getSize() + 1;
-                    killSnake(snake, "Tried to move to other snake's body", false);
-                }
-                continue;
-            }
-
-            snake->pushPos(target);
-            this->setSquare(target, Square::snake(snake->getID()));
-        }
-    }
-
-    updateFood();
-
-    this->currTurn++;
-
-    pushChanges();
-    requestMoves();
 }
 
-bool Game::isTimeout() const {
-    using namespace std::chrono;
-    auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
-    return now.count() - this->lastMoveAsk > TIMEOUT_MS;
+unsigned int Game::minTurnMs() const {
+    return this->pacing.mode == PacingMode::FIXED ? this->pacing.minTurnMs : 0;
 }
 
-bool Game::canTick() const {
-    using namespace std::chrono;
-    auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
-    return now.count() - this->lastMoveAsk > 80;
-}
-
-void Game::killSnake(Snake *snake, std::string reason, bool timeout) {
-    if (!snake->isAlive()) {
-        std::cerr << "Tried to kill a dead snake" << std::endl;
-        return;
+unsigned int Game::nextMoveTimeoutMs() const {
+    if (this->pacing.mode != PacingMode::ADAPTIVE) {
+        return this->pacing.timeoutMs;
     }
-    std::cout << "Killing snake " << snake->getPlayer()->getName() << ": " << reason << std::endl;
 
-    snake->kill();
-    snake->getPlayer()->died(*this, *snake, reason, timeout);
-    snake->diedOnTurn = this->currTurn;
+    uint32_t slowestUs = 0;
 
-    std::queue<Pos> snakeBody = snake->getBody();
-
-    while (!snakeBody.empty()) {
-        Pos pos = snakeBody.front();
-        snakeBody.pop();
-        this->setSquare(pos, Square::empty());
-    }
+    for (const Snake& snake : this->snakes) {
+        if (!snake.isAlive()) continue;
 
-    this->snakesDeadThisTurn.emplace_back(snake);
-}
+        const ResponseTimes& times = snake.getPlayer()->getResponseTimes();
+        if (times.size() < MIN_RESPONSE_SAMPLES) {
+            return this->pacing.timeoutMs;
+        }
 
-//Linear
-float getScore(int rank, int numSnakes) {
-    return (numSnakes - rank) / (float) (numSnakes * (numSnakes - 1) / 2);
-}
+        slowestUs = std::max(slowestUs, times.percentile(this->pacing.percentile));
+    }
 
-unsigned int Game::getNumRows() const {
-    return numRows;
+    auto timeoutMs = (unsigned int) std::ceil(this->pacing.margin * (float) slowestUs / 1000.0f);
+    return std::clamp(timeoutMs, std::min(this->pacing.minTimeoutMs, this->pacing.timeoutMs), this->pacing.timeoutMs);
 }
 
-unsigned int Game::getNumCols() const {
-    return numCols;
-}
+void Game::pushChanges() {
+    //Grid indices go row by row, so this is the same order as sorting by position
+    std::sort(this->changedCells.begin(), this->changedCells.end());
 
-bool Game::hasGameEnded() const {
-    int snakesAlive = 0;
+    this->changesToBroadcast.changes.clear();
 
-    for (const Snake& s : this->snakes) {
-        if (s.isAlive()) {
-            snakesAlive++;
-        }
+    for (unsigned int i : this->changedCells) {
+        this->changesToBroadcast.changes.emplace_back(this->posOf(i), this->grid[i]);
+        //Every set bit in the word is in the list, so the whole word can go
+        this->dirty[i >> 6] = 0;
     }
 
-    return snakesAlive <= 1;
-}
+    this->changedCells.clear();
 
-int snakeSizeScore(const Snake& snake) {
-    return snake.getSize() - snake.startSize + (snake.isAlive() ? 10 : 0);
-}
-
-void Game::finish() {
-    std::vector<Snake*> snakePtrs;
+    this->changesToBroadcast.newTurn = this->currTurn;
+    this->changesToBroadcast.isEncoded = false;
+    this->changesToBroadcast.isCompactEncoded = false;
 
     for (Snake& snake : this->snakes) {
-        snakePtrs.push_back(&snake);
         if (snake.isAlive()) {
-            snake.diedOnTurn = 1 << 30;
+            snake.getPlayer()->receiveChanges(*this, snake, this->changesToBroadcast);
         }
     }
 
-    std::sort(snakePtrs.begin(), snakePtrs.end(), [](Snake* a, Snake* b) {
-        int aScore = snakeSizeScore(*a);
-        int bScore = snakeSizeScore(*b);
-
-        if (aScore == bScore) {
-            return a->diedOnTurn > b->diedOnTurn;
-        } else {
-            return aScore > bScore;
-        }
-    });
-
-    std::vector<float> scores;
-    std::vector<unsigned int> ranks;
-    std::vector<unsigned int> numTies;
-
-    for (int i = 0; i < snakePtrs.size(); i++) {
-        scores.push_back(getScore(i + 1, snakePtrs.size()));
-    }
-
-    //Average score of snakes with same size score + diedOnTurn
-
-    int backPtr = 0;
-    int frontPtr = 0;
-    float totalScore = 0;
-    int numSnakes = 0;
-    while (frontPtr < snakePtrs.size()) {
-        if (snakeSizeScore(*snakePtrs[frontPtr]) == snakeSizeScore(*snakePtrs[backPtr]) && snakePtrs[frontPtr]->diedOnTurn == snakePtrs[backPtr]->diedOnTurn) {
-            totalScore += scores[frontPtr];
-            numSnakes++;
-            frontPtr++;
-        } else {
-            float score = totalScore / numSnakes;
+}
 
-            for (int i = backPtr; i < frontPtr; i++) {
-                scores[i] = score;
-                ranks.push_back(backPtr + 1);
-                numTies.push_back(numSnakes);
-            }
+void Game::tryTick(GameClock::time_point now) {
+    using namespace std::chrono;
 
-            backPtr = frontPtr;
-            totalScore = 0;
-            numSnakes = 0;
+    //Woken too early, only one wake up is kept so ask for the next one
+    if (now - this->lastMoveAsk < milliseconds(minTurnMs())) {
+        if (this->scheduler) {
+            this->scheduler->schedule(this, this->lastMoveAsk + milliseconds(minTurnMs()));
         }
+        return;
     }
 
-    float score = totalScore / numSnakes;
-
-    for (int i = backPtr; i < frontPtr; i++) {
-        scores[i] = score;
-        ranks.push_back(backPtr + 1);
-        numTies.push_back(numSnakes);
-    }
-
-    int totalChange = 0;
-    std::vector<int> changes;
-    for (int i = 0; i < snakePtrs.size(); i++) {
-        float score = scores[i];
-        float expectedScore = expectedScores[snakePtrs[i]];
-        float scoreDiff = score - expectedScore;
-
-        int change = ((int) (scoreDiff * ELO_K * (snakePtrs.size() - 1)));
-        totalChange += change;
-
-        changes.push_back(change);
-    }
-
-    //Sometimes because of rounding, the total change is not exactly zero. In that case we just punish the bottom or reward the top
-    if (totalChange < 0) {
-        changes[0] -= totalChange;
-    } else if (totalChange > 0) {
-        changes[changes.size() - 1] -= totalChange;
+    if (this->movesPending > 0 && now - this->lastMoveAsk < milliseconds(this->moveTimeoutMs)) {
+        if (this->scheduler) {
+            this->scheduler->schedule(this, this->lastMoveAsk + milliseconds(this->moveTimeoutMs));
+        }
+        return;
     }
 
-    for (int i = 0; i < snakePtrs.size(); i++) {
-        Snake* snake = snakePtrs[i];
-        int newElo = snake->getPlayer()->getElo() + changes[i];
-        snake->getPlayer()->setElo(newElo);
+    this->clearDeaths();
 
-        snake->getPlayer()->endGame(
-                *this,
-                *snake,
-                !snake->isAlive(),
-                snake->getSize(),
-                snakeSizeScore(*snake),
-                snake->diedOnTurn,
-                ranks[i],
-                numTies[i],
-                newElo
-        );
+    for (Snake& snake : this->snakes) {
+        if (snake.isAlive() && !snake.getPlayer()->nextMove().has_value()) {
+            this->replay->timeouts.push_back({this->currTurn, snake.getID()});
+            timeOut(snake.getID());
+        }
     }
-}
-/*
-void Game::updateScores() {
-    int numAliveSnakes = 0;
 
     for (Snake& snake : this->snakes) {
         if (snake.isAlive()) {
-            numAliveSnakes++;
+            Move move = snake.getPlayer()->nextMove().value();
+
+            this->turnMoves[snake.getID()] = move;
+            this->replay->addMove(move);
         }
     }
 
-    float actualScore = 0;
+    step(this->turnMoves.data());
+    totalTurnsPlayed.fetch_add(1, std::memory_order_relaxed);
 
-    //Take average of scores for ties
-    for (Snake* snake: this->snakesDeadThisTurn) {
-        actualScore += getScore(++numAliveSnakes, this->snakes.size());
-    }
+    reportDeaths();
 
-    actualScore /= this->snakesDeadThisTurn.size();
+    pushChanges();
+    requestMoves();
+}
 
-    for (Snake* snake: this->snakesDeadThisTurn) {
-        float expectedScore = this->expectedScores[snake];
-        float excess = actualScore - expectedScore;
-        float change = ELO_K * (this->snakes.size() - 1) * excess;
+void Game::reportDeaths() {
+    for (const Death& death : this->deaths) {
+        Snake& snake = this->snakes[death.snake];
+        bool timeout = death.cause == DeathCause::TIMEOUT;
 
-        snake->getPlayer()->setElo(snake->getPlayer()->getElo() + change);
-    }
-}
-*/
+        //Built in a buffer the game keeps, so a death doesn't allocate once the longest reason has been seen
+        std::string& reason = this->deathReason;
 
-GameConfig::SnakeConfig::SnakeConfig(std::initializer_list<Pos> body)
-    :back({0, 0})
-{
-    assert(body.size() > 0);
+        if (timeout) {
+            char text[64];
+            snprintf(text, sizeof(text), "Didn't receive move after %ums", this->moveTimeoutMs);
+            reason.assign(text);
+        } else {
+            reason.assign(deathCauseName(death.cause));
+        }
 
-    this->back = *body.begin();
+        std::cout << "Killing snake " << snake.getPlayer()->getName() << ": " << reason << std::endl;
 
-    auto itFrom = body.begin(), itTo = body.begin() + 1;
+        //Only a player that used up the longest timeout there is gets kicked
+        bool kick = timeout && this->moveTimeoutMs >= this->pacing.timeoutMs;
 
-    for (int i = 0; i < body.size() - 1; i++) {
-        this->body.push_back(getMove(*itFrom, *itTo));
-        itFrom++;
-        itTo++;
+        snake.getPlayer()->died(*this, snake, reason, timeout, kick);
     }
 }
 
-GameConfig GameConfig::fromFile(const std::string& filename) {
-    using namespace nlohmann;
+void Game::finish() {
+    std::vector<int> elos;
 
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        throw std::runtime_error("Could not open file " + filename);
+    for (Snake& snake : this->snakes) {
+        snake.getPlayer()->stopAwaitingMove();
+        elos.push_back(this->replay->players[snake.getID()].elo);
     }
 
-    json root;
-    file >> root;
-
-    unsigned int numRows = root["num_rows"];
-    unsigned int numCols = root["num_cols"];
-    unsigned int numFood = root["num_food"];
-
-    std::vector<GameConfig::SnakeConfig> snakes;
+    std::vector<SnakeResult> results;
+    computeResults(elos, results);
 
-    for (json snakeJson : root["snakes"]) {
-        SnakeConfig snakeConfig;
+    this->replay->numTurns = this->currTurn;
 
-        snakeConfig.back = {snakeJson["back"][0], snakeJson["back"][1]};
-
-        for (std::string moveName: snakeJson["body"]) {
-            snakeConfig.body.push_back(getMove(moveName));
-        }
-
-        snakes.push_back(snakeConfig);
-    }
+    for (Snake& snake : this->snakes) {
+        SnakeResult& result = results[snake.getID()];
+        snake.getPlayer()->setElo(result.newElo);
 
-    return {numRows, numCols, numFood, snakes};
-}
+        this->replay->results.push_back({result.died, result.length, result.diedOn, result.rank, result.newElo});
 
-static Move getMove(std::string name) {
-    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
-
-    if (name == "up" || name == "u" || name == "north" || name == "n") {
-        return Move::UP;
-    } else if (name == "down" || name == "d" || name == "south" || name == "s") {
-        return Move::DOWN;
-    } else if (name == "left" || name == "l" || name == "west" || name == "w") {
-        return Move::LEFT;
-    } else if (name == "right" || name == "r" || name == "east" || name == "e") {
-        return Move::RIGHT;
-    } else {
-        throw std::runtime_error("Invalid move name: " + name);
+        snake.getPlayer()->endGame(
+                *this,
+                snake,
+                result.died,
+                result.length,
+                result.score,
+                result.diedOn,
+                result.rank,
+                result.numTies,
+                result.newElo
+        );
     }
 }
@@ -3,147 +3,173 @@
 //
 
 #include "GameCreator.h"
+#include "network/snake_network.h"
+#include "SharedBuffer.h"
+#include "DummyPlayer.h"
+#include "SearchPlayer.h"
 #include <algorithm>
 #include <random>
 #include <iostream>
+#include <set>
 
-static const char* DEFAULT_CONFIG = "smallfour";
-
-static std::string fullPath(const std::string& base) {
-    return "./res/layouts/" + base + ".json";
-}
-
-GameCreator::GameCreator(unsigned int targetGameAmount)
-    : config(GameConfig::fromFile(fullPath(DEFAULT_CONFIG))), targetGameAmount(targetGameAmount)
+GameCreator::GameCreator(const ServerConfig& serverConfig)
+    : serverConfig(serverConfig), config(GameConfig::fromFile(layoutPath(serverConfig.layout))),
+      pacing(serverConfig.pacingFor(layoutPath(serverConfig.layout))), targetGameAmount(serverConfig.numGames)
 {
-    this->games.resize(targetGameAmount);
+    unsigned int numShards = serverConfig.numThreads > 0 ? serverConfig.numThreads : 1;
 
-    for (unsigned int i = 0; i < targetGameAmount; i++) {
-        this->displays.emplace_back(GameDisplay());
+    for (unsigned int i = 0; i < numShards; i++) {
+        this->shards.emplace_back(std::make_unique<GameShard>(i, [this]() {
+            if (this->wakeMain) {
+                this->wakeMain();
+            }
+        }));
     }
 
-    memset(this->fileBuf, 0, 64);
-    strcpy_s(this->fileBuf, DEFAULT_CONFIG);
-}
-
-void GameCreator::tryShrink() {
-    int i = 0;
-    while (i < this->games.size() && this->games.size() > this->targetGameAmount) {
-        if (this->games[i] == nullptr) {
-            this->games.erase(this->games.begin() + i);
-        } else {
-            i++;
-        }
+    if (!serverConfig.replayFile.empty()) {
+        this->replayWriter = std::make_unique<ReplayWriter>(serverConfig.replayFile);
     }
-}
 
-void GameCreator::addPlayer(Player *player) {
-    this->freePlayers.push_back(player);
+    addBuiltInBots();
 }
 
-void GameCreator::render() {
-    for (GameDisplay& display : this->displays) {
-        display.renderWindow();
+GameCreator::~GameCreator() {
+    for (auto& shard : this->shards) {
+        shard->stop();
     }
+}
 
-    //Leaderboard
-    ImGui::Begin("Leaderboard");
-    ImGui::Text("Leaderboard");
-    ImGui::BeginChild("Leaderboard", ImVec2(0, 0), true);
-
-    //Get all players
-    std::vector<Player*> players;
+void GameCreator::start(std::function<void()> wakeMain) {
+    if (isThreaded()) {
+        this->wakeMain = std::move(wakeMain);
 
-    for (Game* game : this->games) {
-        if (game != nullptr) {
-            for (Snake& snake : game->snakes) {
-                players.push_back(snake.getPlayer());
-            }
+        for (auto& shard : this->shards) {
+            shard->start();
         }
-    }
 
-    for (Player* player : freePlayers) {
-        players.push_back(player);
+        std::cout << "Running games on " << this->shards.size() << " threads" << std::endl;
     }
+}
 
-    //Sort players by elo
-    std::sort(players.begin(), players.end(), [](Player* a, Player* b) {
-        return a->getElo() > b->getElo();
-    });
+void GameCreator::addPlayer(Player *player) {
+    this->players.push_back(player);
+    this->freePlayers.push_back(player);
+}
 
-    //Render players
-    int totalScore = 0;
-    for (Player* player : players) {
-        ImGui::PushStyleColor(ImGuiCol_Text, (uint32_t) player->getColor());
-        ImGui::Text("%s: %d", player->getName().c_str(), player->getElo());
-        ImGui::PopStyleColor();
+void GameCreator::addBuiltInBots() {
+    bool dummies = this->serverConfig.botType == "dummy";
 
-        totalScore += player->getElo();
+    if (!dummies && this->serverConfig.botType != "search") {
+        std::cerr << "Unknown bot type " << this->serverConfig.botType << ", using search bots" << std::endl;
     }
 
-    ImGui::EndChild();
-    ImGui::End();
-
-    //Options menu
-    ImGui::Begin("Options");
+    for (unsigned int i = 0; i < this->serverConfig.numBots; i++) {
+        std::string name = getPlayerName(dummies ? "Dummy" : "Bot");
+        Color color = getPlayerColor({0, 0, 0});
 
-    //Text entry for layout path
-    ImGui::InputText("Layout path", this->fileBuf, 64);
-
-    if (ImGui::Button("Update")) {
-        try {
-            this->config = GameConfig::fromFile(fullPath(this->fileBuf));
-        } catch (std::runtime_error& e) {
-            std::cout << "Error: " << e.what() << std::endl;
+        if (dummies) {
+            this->builtInBots.push_back(std::make_unique<DummyPlayer>(name, color));
+        } else {
+            this->builtInBots.push_back(std::make_unique<SearchPlayer>(name, color, this->serverConfig.botBudgetUs));
         }
+
+        addPlayer(this->builtInBots.back().get());
     }
 
-    ImGui::End();
+    if (this->serverConfig.numBots > 0) {
+        std::cout << "Added " << this->serverConfig.numBots << " " << this->serverConfig.botType << " bots" << std::endl;
+    }
+}
 
-    //std::cout << "Total score: " << totalScore << std::endl;
+void GameCreator::removePlayer(Player* player) {
+    this->players.erase(std::remove(this->players.begin(), this->players.end(), player), this->players.end());
+    player->onRemoved();
 }
 
 void GameCreator::tick() {
     for (int i = 0; i < this->freePlayers.size(); i++) {
         if (this->freePlayers[i]->kicked) {
-            this->freePlayers[i]->onRemoved();
+            removePlayer(this->freePlayers[i]);
             this->freePlayers.erase(this->freePlayers.begin() + i);
             i--;
         }
     }
 
-    for (auto & game : this->games) {
-        if (game != nullptr) {
-            if (game->hasGameEnded()) {
-                game->finish();
+    if (!isThreaded()) {
+        GameClock::time_point now = GameClock::now();
 
-                for (Snake& snake : game->snakes) {
-                    if (snake.getPlayer()->kicked) {
-                        snake.getPlayer()->onRemoved();
-                    } else {
-                        snake.getPlayer()->inGame = false;
-                        this->freePlayers.push_back(snake.getPlayer());
-                    }
-                }
+        for (auto& shard : this->shards) {
+            shard->tick(now);
+        }
+    }
 
-                for (GameDisplay& display : this->displays) {
-                    if (display.game == game) {
-                        display.game = nullptr;
-                    }
+    for (auto& shard : this->shards) {
+        handleShardOutput(*shard);
+    }
+
+    tryMakeNewGame();
+}
+
+int GameCreator::msUntilNextTick(int maxMs) const {
+    if (isThreaded()) {
+        //Shards keep their own time, they wake us up when they have something
+        return maxMs;
+    }
+
+    GameClock::time_point now = GameClock::now();
+    int wait = maxMs;
+
+    for (auto& shard : this->shards) {
+        wait = MIN_T(wait, shard->msUntilNextTick(now, maxMs));
+    }
+
+    return wait;
+}
+
+void GameCreator::handleShardOutput(GameShard& shard) {
+    GameShard::Output out;
+
+    while (shard.popOutput(out)) {
+        switch (out.type) {
+            case GameShard::Output::PACKET:
+                out.connection->sendData(out.packet.data, out.packet.len, out.payload);
+
+                if (out.payload) {
+                    out.payload->release();
                 }
+                break;
+            case GameShard::Output::DROP_CONNECTION:
+                //Dropped at the end of the network tick, like a connection that failed while sending
+                out.connection->failed = true;
+                break;
+            case GameShard::Output::GAME_FINISHED:
+                endGame(shard, out.game);
+                break;
+        }
+    }
+}
 
-                delete game;
-                game = nullptr;
-                currentGameAmount--;
-            } else {
-                game->tryTick();
-            }
+void GameCreator::endGame(GameShard& shard, Game* game) {
+    if (this->replayWriter) {
+        this->replayWriter->write(game->getReplay());
+    }
+
+    for (Snake& snake : game->snakes) {
+        Player* player = snake.getPlayer();
+        player->shard = nullptr;
+
+        if (player->kicked) {
+            removePlayer(player);
+        } else {
+            player->inGame = false;
+            this->freePlayers.push_back(player);
         }
     }
 
-    tryShrink();
+    delete game;
 
-    tryMakeNewGame();
+    shard.numGames--;
+    currentGameAmount--;
 }
 
 void GameCreator::tryMakeNewGame() {
@@ -168,23 +194,21 @@ void GameCreator::tryMakeNewGame() {
                 this->freePlayers.erase(this->freePlayers.begin() + indices[i]);
             }
 
-            unsigned int freeGameIndex = 0;
-
-            while (freeGameIndex < this->games.size() && this->games[freeGameIndex] != nullptr) {
-                freeGameIndex++;
+            //Least loaded shard
+            GameShard* shard = this->shards[0].get();
+            for (auto& candidate : this->shards) {
+                if (candidate->numGames < shard->numGames) {
+                    shard = candidate.get();
+                }
             }
 
-            assert(freeGameIndex < this->games.size());
-
-            this->games[freeGameIndex] = new Game(this->config, players);
-
-            for (GameDisplay& display: displays) {
-                if (display.game == nullptr) {
-                    display.game = this->games[freeGameIndex];
-                    break;
-                }
+            for (Player* player : players) {
+                player->shard = shard;
             }
 
+            shard->postNewGame(this->config, this->pacing, players, GameRng::randomSeed());
+            shard->numGames++;
+
             currentGameAmount++;
         } else {
             break;
@@ -195,15 +219,7 @@ void GameCreator::tryMakeNewGame() {
 std::string GameCreator::getPlayerName(std::string name) {
     std::set<std::string> allNames;
 
-    for (Game* game : this->games) {
-        if (game != nullptr) {
-            for (Snake& snake : game->snakes) {
-                allNames.insert(snake.getPlayer()->getName());
-            }
-        }
-    }
-
-    for (Player* player : this->freePlayers) {
+    for (Player* player : this->players) {
         allNames.insert(player->getName());
     }
 
@@ -0,0 +1,113 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#include "GameScheduler.h"
+#include "Game.h"
+
+void GameScheduler::add(Game* game) {
+    game->heapIndex = NOT_SCHEDULED;
+    this->numGames++;
+}
+
+void GameScheduler::remove(Game* game) {
+    if (game->heapIndex != NOT_SCHEDULED) {
+        erase(game->heapIndex);
+    }
+
+    this->numGames--;
+}
+
+void GameScheduler::schedule(Game* game, GameClock::time_point when) {
+    if (game->heapIndex == NOT_SCHEDULED) {
+        game->wakeAt = when;
+        this->heap.push_back(game);
+        game->heapIndex = this->heap.size() - 1;
+        siftUp(game->heapIndex);
+    } else if (when < game->wakeAt) {
+        game->wakeAt = when;
+        siftUp(game->heapIndex);
+    }
+}
+
+Game* GameScheduler::popDue(GameClock::time_point now) {
+    if (this->heap.empty() || this->heap.front()->wakeAt > now) {
+        return nullptr;
+    }
+
+    Game* game = this->heap.front();
+    erase(0);
+
+    return game;
+}
+
+int GameScheduler::msUntilNextDue(GameClock::time_point now, int maxMs) const {
+    if (this->heap.empty()) {
+        return maxMs;
+    }
+
+    using namespace std::chrono;
+    auto untilNext = duration_cast<microseconds>(this->heap.front()->wakeAt - now).count();
+
+    if (untilNext <= 0) {
+        return 0;
+    }
+
+    //Round up so we don't wake up just before the deadline and spin
+    return (int) MIN_T((untilNext + 999) / 1000, (long long) maxMs);
+}
+
+void GameScheduler::place(size_t i, Game* game) {
+    this->heap[i] = game;
+    game->heapIndex = i;
+}
+
+void GameScheduler::siftUp(size_t i) {
+    Game* game = this->heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!(game->wakeAt < this->heap[parent]->wakeAt)) break;
+
+        place(i, this->heap[parent]);
+        i = parent;
+    }
+
+    place(i, game);
+}
+
+void GameScheduler::siftDown(size_t i) {
+    Game* game = this->heap[i];
+    size_t size = this->heap.size();
+
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= size) break;
+
+        if (child + 1 < size && this->heap[child + 1]->wakeAt < this->heap[child]->wakeAt) {
+            child++;
+        }
+
+        if (!(this->heap[child]->wakeAt < game->wakeAt)) break;
+
+        place(i, this->heap[child]);
+        i = child;
+    }
+
+    place(i, game);
+}
+
+void GameScheduler::erase(size_t i) {
+    Game* game = this->heap[i];
+    game->heapIndex = NOT_SCHEDULED;
+
+    Game* last = this->heap.back();
+    this->heap.pop_back();
+
+    if (last == game) return;
+
+    //The last game fills the hole, then goes whichever way it has to
+    place(i, last);
+    siftUp(i);
+    siftDown(last->heapIndex);
+}
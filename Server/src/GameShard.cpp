@@ -0,0 +1,195 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#include "GameShard.h"
+#include "SharedBuffer.h"
+
+#include <algorithm>
+
+//A shard with nothing scheduled still wakes up this often
+#define MAX_SHARD_SLEEP_MS 100
+
+GameShard::GameShard(unsigned int id, std::function<void()> onOutput)
+    :id(id), onOutput(std::move(onOutput))
+{}
+
+GameShard::~GameShard() {
+    stop();
+
+    for (Game* game : this->games) {
+        delete game;
+    }
+
+    Command command;
+    while (this->commands.pop(command)) {
+        delete command.newGame;
+    }
+
+    Output out;
+    while (this->output.pop(out)) {
+        if (out.payload) {
+            out.payload->release();
+        }
+    }
+}
+
+void GameShard::start() {
+    if (this->running) return;
+
+    this->running = true;
+    this->thread = std::thread(&GameShard::run, this);
+}
+
+void GameShard::stop() {
+    if (!this->running) return;
+
+    {
+        std::lock_guard<std::mutex> lock(this->sleepMutex);
+        this->running = false;
+        this->woken = true;
+    }
+    this->sleepCondition.notify_one();
+
+    this->thread.join();
+}
+
+void GameShard::postNewGame(const GameConfig& config, const Pacing& pacing, std::vector<Player*> players, uint64_t seed) {
+    Command command{};
+    command.type = Command::NEW_GAME;
+    command.newGame = new NewGame{config, pacing, std::move(players), seed};
+
+    this->commands.push(command);
+    wake();
+}
+
+void GameShard::postMove(Player* player, Move move, std::optional<unsigned int> turn) {
+    Command command{};
+    command.type = Command::MOVE;
+    command.player = player;
+    command.move = move;
+    command.turn = turn;
+
+    this->commands.push(command);
+    wake();
+}
+
+void GameShard::postPacket(Connection* connection, const SmallPacket& packet, SharedBuffer* payload) {
+    this->output.push({Output::PACKET, connection, packet, payload, nullptr});
+    this->producedOutput = true;
+}
+
+void GameShard::postDropConnection(Connection* connection) {
+    this->output.push({Output::DROP_CONNECTION, connection, {}, nullptr, nullptr});
+    this->producedOutput = true;
+}
+
+bool GameShard::popOutput(Output& out) {
+    return this->output.pop(out);
+}
+
+void GameShard::wake() {
+    //Pairs with the fence in run(), either the shard sees the command or we see that it's asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (this->sleeping.load()) {
+        {
+            std::lock_guard<std::mutex> lock(this->sleepMutex);
+            this->woken = true;
+        }
+        this->sleepCondition.notify_one();
+    }
+}
+
+void GameShard::run() {
+    while (this->running) {
+        tick(GameClock::now());
+
+        int waitMs = msUntilNextTick(GameClock::now(), MAX_SHARD_SLEEP_MS);
+        if (waitMs == 0) continue;
+
+        std::unique_lock<std::mutex> lock(this->sleepMutex);
+        this->sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (this->commands.empty()) {
+            this->sleepCondition.wait_for(lock, std::chrono::milliseconds(waitMs), [this]() {
+                return this->woken;
+            });
+        }
+
+        this->woken = false;
+        this->sleeping = false;
+    }
+}
+
+void GameShard::tick(GameClock::time_point now) {
+    handleCommands();
+
+    while (Game* game = this->scheduler.popDue(now)) {
+        if (!game->hasGameEnded()) {
+            game->tryTick(now);
+        }
+
+        if (game->hasGameEnded()) {
+            finishGame(game);
+        }
+    }
+
+    if (this->producedOutput) {
+        this->producedOutput = false;
+
+        if (this->onOutput) {
+            this->onOutput();
+        }
+    }
+}
+
+int GameShard::msUntilNextTick(GameClock::time_point now, int maxMs) const {
+    return this->scheduler.msUntilNextDue(now, maxMs);
+}
+
+void GameShard::handleCommands() {
+    Command command;
+
+    while (this->commands.pop(command)) {
+        switch (command.type) {
+            case Command::NEW_GAME: {
+                for (Player* player : command.newGame->players) {
+                    this->players.insert(player);
+                }
+
+                Game* game = new Game(command.newGame->config, command.newGame->players, command.newGame->seed,
+                                      command.newGame->pacing, &this->scheduler);
+                delete command.newGame;
+
+                this->games.push_back(game);
+
+                if (game->hasGameEnded()) {
+                    finishGame(game);
+                }
+                break;
+            }
+            case Command::MOVE:
+                if (this->players.count(command.player)) {
+                    command.player->receiveMove(command.move, command.turn);
+                }
+                break;
+        }
+    }
+}
+
+void GameShard::finishGame(Game* game) {
+    game->finish();
+
+    this->scheduler.remove(game);
+    this->games.erase(std::remove(this->games.begin(), this->games.end(), game), this->games.end());
+
+    for (Snake& snake : game->snakes) {
+        this->players.erase(snake.getPlayer());
+    }
+
+    //The main thread deletes it once it has handed the players back
+    this->output.push({Output::GAME_FINISHED, nullptr, {}, nullptr, game});
+    this->producedOutput = true;
+}
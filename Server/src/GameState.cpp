@@ -0,0 +1,524 @@
+//
+// Created by Anatol on 23/06/2022.
+//
+
+#include "../headers/GameState.h"
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+#include <json/json.hpp>
+#include <fstream>
+
+// Multiplayer ELO is based on https://towardsdatascience.com/developing-a-generalized-elo-rating-system-for-multiplayer-games-b9b495e87802
+
+static Move getMove(std::string basicString);
+
+GameState::GameState(const GameConfig& config, std::vector<Player*>& players, uint64_t seed, bool trackChanges)
+        :seed(seed),
+        rng(seed),
+        numRows(config.numRows),
+        numCols(config.numCols),
+        numFood(config.numFood),
+        trackChanges(trackChanges)
+{
+    this->stride = numCols + 2;
+    this->grid.resize((numRows + 2) * stride, Cell::wall());
+    this->open = BitBoard(this->grid.size(), stride);
+    this->food = BitBoard(this->grid.size(), stride);
+
+    this->emptySlot.resize((numRows + 2) * stride, NOT_EMPTY);
+    this->emptyCells.reserve(numRows * numCols);
+
+    this->dirty.resize(((numRows + 2) * stride + 63) / 64, 0);
+
+    //A turn can change at most every square, so recording changes never has to grow
+    if (trackChanges) {
+        this->changedCells.reserve(this->grid.size());
+    }
+
+    this->snakes.reserve(config.snakes.size());
+    this->headTargets.reserve(config.snakes.size());
+    this->deaths.reserve(config.snakes.size());
+
+    this->reset(config, players, seed);
+}
+
+void GameState::reset(const GameConfig& config, std::vector<Player*>& players, uint64_t newSeed) {
+    this->seed = newSeed;
+    this->rng = GameRng(newSeed);
+    this->currTurn = 0;
+    this->numFoodOnBoard = 0;
+
+    this->open.clear();
+    this->food.clear();
+    this->emptyCells.clear();
+    std::fill(this->dirty.begin(), this->dirty.end(), 0);
+    this->changedCells.clear();
+    this->deaths.clear();
+
+    for (unsigned int row = 0; row < numRows; row++) {
+        for (unsigned int col = 0; col < numCols; col++) {
+            unsigned int i = this->idx({row, col});
+
+            this->grid[i] = Cell::empty();
+            this->open.set(i);
+            this->emptySlot[i] = this->emptyCells.size();
+            this->emptyCells.push_back(i);
+        }
+    }
+
+    //Shuffle players
+    this->rng.shuffle(players);
+
+    if (players.size() != config.snakes.size()) {
+        std::cerr << "Number of players does not match number of snakes" << std::endl;
+    }
+
+    unsigned int numSnakes = MIN_T(players.size(), config.snakes.size());
+
+    //Snakes from the last game keep their bodies' storage
+    if (this->snakes.size() > numSnakes) {
+        this->snakes.erase(this->snakes.begin() + numSnakes, this->snakes.end());
+    }
+
+    for (unsigned int i = 0; i < numSnakes; i++) {
+        if (i < this->snakes.size()) {
+            this->snakes[i].reset(players[i]);
+        } else {
+            this->snakes.emplace_back(players[i], i, (size_t) numRows * numCols);
+        }
+
+        Snake& snake = this->snakes[i];
+
+        Pos p = config.snakes[i].back;
+        this->setCell(p, Cell::snake(i));
+        snake.pushPos(p);
+
+        for (Move move : config.snakes[i].body) {
+            p = p + move;
+            this->setCell(p, Cell::snake(i));
+
+            snake.pushPos(p);
+        }
+
+        snake.startSize = snake.getBody().size();
+    }
+
+    updateFood();
+}
+
+Cell GameState::setCell(Pos pos, Cell value) {
+    unsigned int i = this->idx(pos);
+
+    Cell old = this->grid[i];
+    this->grid[i] = value;
+    this->open.assign(i, value.canMoveTo());
+    this->food.assign(i, value.value == Cell::FOOD);
+
+    if (old.value == Cell::EMPTY && value.value != Cell::EMPTY) {
+        //Swap the last empty cell into this one's slot
+        unsigned int slot = this->emptySlot[i];
+        unsigned int last = this->emptyCells.back();
+
+        this->emptyCells[slot] = last;
+        this->emptySlot[last] = slot;
+        this->emptyCells.pop_back();
+        this->emptySlot[i] = NOT_EMPTY;
+    } else if (old.value != Cell::EMPTY && value.value == Cell::EMPTY) {
+        this->emptySlot[i] = this->emptyCells.size();
+        this->emptyCells.push_back(i);
+    }
+
+    this->numFoodOnBoard += (value.value == Cell::FOOD) - (old.value == Cell::FOOD);
+
+    if (this->trackChanges) {
+        uint64_t bit = 1ull << (i & 63);
+        if (!(this->dirty[i >> 6] & bit)) {
+            this->dirty[i >> 6] |= bit;
+            this->changedCells.push_back(i);
+        }
+    }
+
+    return old;
+}
+
+GameState GameState::fork() const {
+    GameState out(*this);
+
+    out.trackChanges = false;
+    out.changedCells.clear();
+    std::fill(out.dirty.begin(), out.dirty.end(), 0);
+
+    return out;
+}
+
+void GameState::forkInto(GameState& out) const {
+    //Vectors keep their capacity when assigned to, and every state of a game has the same sizes
+    out.seed = this->seed;
+    out.rng = this->rng;
+
+    out.numRows = this->numRows;
+    out.numCols = this->numCols;
+    out.numFood = this->numFood;
+    out.currTurn = this->currTurn;
+    out.stride = this->stride;
+    out.grid = this->grid;
+    out.open = this->open;
+    out.food = this->food;
+
+    out.trackChanges = false;
+    out.changedCells.clear();
+
+    out.emptyCells = this->emptyCells;
+    out.emptySlot = this->emptySlot;
+    out.numFoodOnBoard = this->numFoodOnBoard;
+
+    out.snakes = this->snakes;
+    out.deaths = this->deaths;
+}
+
+void GameState::copyBoard(uint8_t* out) const {
+    static_assert(sizeof(Cell) == 1);
+
+    for (unsigned int row = 0; row < this->numRows; row++) {
+        memcpy(out + (size_t) row * this->numCols, &this->grid[this->idx({row, 0})], this->numCols);
+    }
+}
+
+void GameState::updateFood() {
+    //Placing food takes the cell out of emptyCells, so every pick is from what is still free
+    while (this->numFoodOnBoard < this->numFood && !this->emptyCells.empty()) {
+        this->setCell(this->posOf(this->emptyCells[this->rng.below(this->emptyCells.size())]), Cell::food());
+    }
+}
+
+void GameState::timeOut(unsigned int snake) {
+    Snake& timedOut = this->snakes[snake];
+
+    timedOut.sizeOnDeath = timedOut.getSize();
+    killSnake(timedOut, DeathCause::TIMEOUT);
+}
+
+void GameState::step(const Move* moves) {
+    this->headTargets.clear();
+
+    for (Snake& snake : this->snakes) {
+        if (snake.isAlive()) {
+            this->headTargets.push_back({snake.getHead() + moves[snake.getID()], snake.getID()});
+        }
+    }
+
+    //Snakes going to the same square end up next to each other. Ties keep snake order
+    std::sort(this->headTargets.begin(), this->headTargets.end(), [](const HeadTarget& a, const HeadTarget& b) {
+        if (a.target < b.target) return true;
+        if (b.target < a.target) return false;
+        return a.snake < b.snake;
+    });
+
+    size_t numTargets = this->headTargets.size();
+
+    for (size_t begin = 0, end; begin < numTargets; begin = end) {
+        Pos target = this->headTargets[begin].target;
+
+        end = begin + 1;
+        while (end < numTargets && !(target < this->headTargets[end].target)) {
+            end++;
+        }
+
+        if (end - begin > 1) {
+            for (size_t i = begin; i < end; i++) {
+                Snake& snake = this->snakes[this->headTargets[i].snake];
+                snake.sizeOnDeath = snake.getSize();
+                killSnake(snake, DeathCause::HEAD_COLLISION);
+            }
+        } else {
+            Snake& snake = this->snakes[this->headTargets[begin].snake];
+            if (this->getCell(target).value != Cell::FOOD) {
+                this->setCell(snake.retractTail(), Cell::empty());
+            }
+        }
+    }
+
+    //Only snakes that had their square to themselves are still alive
+    for (HeadTarget& headTarget : this->headTargets) {
+        Snake& snake = this->snakes[headTarget.snake];
+        if (!snake.isAlive()) continue;
+
+        Pos target = headTarget.target;
+        Cell cell = this->getCell(target);
+
+        if (!cell.canMoveTo()) {
+            //We retracted the tail but it's length is still one more
+            snake.sizeOnDeath = snake.getSize() + 1;
+
+            if (cell.value == Cell::WALL) {
+                killSnake(snake, DeathCause::OUT_OF_BOUNDS);
+            } else if (cell.snakeID() == snake.getID()) {
+                killSnake(snake, DeathCause::OWN_BODY);
+            } else {
+                killSnake(snake, DeathCause::OTHER_BODY);
+            }
+            continue;
+        }
+
+        snake.pushPos(target);
+        this->setCell(target, Cell::snake(snake.getID()));
+    }
+
+    updateFood();
+
+    this->currTurn++;
+}
+
+void GameState::killSnake(Snake& snake, DeathCause cause) {
+    if (!snake.isAlive()) {
+        std::cerr << "Tried to kill a dead snake" << std::endl;
+        return;
+    }
+
+    snake.kill();
+    snake.diedOnTurn = this->currTurn;
+
+    for (Pos pos: snake.getBody()) {
+        this->setCell(pos, Cell::empty());
+    }
+
+    this->deaths.push_back({snake.getID(), cause});
+}
+
+const char* deathCauseName(DeathCause cause) {
+    switch (cause) {
+        case DeathCause::TIMEOUT:
+            return "Didn't send a move in time";
+        case DeathCause::HEAD_COLLISION:
+            return "Collision with other snake's head";
+        case DeathCause::OUT_OF_BOUNDS:
+            return "Out of bounds";
+        case DeathCause::OWN_BODY:
+            return "Tried to move to own body";
+        case DeathCause::OTHER_BODY:
+            return "Tried to move to other snake's body";
+    }
+
+    return "Unknown";
+}
+
+//Linear
+static float getScore(int rank, int numSnakes) {
+    return (numSnakes - rank) / (float) (numSnakes * (numSnakes - 1) / 2);
+}
+
+unsigned int GameState::getNumRows() const {
+    return numRows;
+}
+
+unsigned int GameState::getNumCols() const {
+    return numCols;
+}
+
+bool GameState::hasGameEnded() const {
+    int snakesAlive = 0;
+
+    for (const Snake& s : this->snakes) {
+        if (s.isAlive()) {
+            snakesAlive++;
+        }
+    }
+
+    return snakesAlive <= 1;
+}
+
+static int snakeSizeScore(const Snake& snake) {
+    return snake.getSize() - snake.startSize + (snake.isAlive() ? 10 : 0);
+}
+
+void GameState::computeResults(const std::vector<int>& elos, std::vector<SnakeResult>& results) {
+    std::vector<Snake*> snakePtrs;
+
+    for (Snake& snake : this->snakes) {
+        snakePtrs.push_back(&snake);
+        if (snake.isAlive()) {
+            snake.diedOnTurn = 1 << 30;
+        }
+    }
+
+    //Calculate expected scores
+    std::vector<float> expectedScores;
+
+    for (Snake& snake: this->snakes) {
+        int currScore = elos[snake.getID()];
+        float total = 0;
+
+        for (Snake& otherSnake: this->snakes) {
+            if (snake.getID() == otherSnake.getID()) {
+                continue;
+            }
+
+            total += 1.0f / (1.f + std::pow(10.f, (elos[otherSnake.getID()] - currScore) / ELO_D));
+        }
+
+        total /= this->snakes.size() * (this->snakes.size() - 1) / 2;
+
+        expectedScores.push_back(total);
+    }
+
+    std::sort(snakePtrs.begin(), snakePtrs.end(), [](Snake* a, Snake* b) {
+        int aScore = snakeSizeScore(*a);
+        int bScore = snakeSizeScore(*b);
+
+        if (aScore == bScore) {
+            return a->diedOnTurn > b->diedOnTurn;
+        } else {
+            return aScore > bScore;
+        }
+    });
+
+    std::vector<float> scores;
+    std::vector<unsigned int> ranks;
+    std::vector<unsigned int> numTies;
+
+    for (int i = 0; i < snakePtrs.size(); i++) {
+        scores.push_back(getScore(i + 1, snakePtrs.size()));
+    }
+
+    //Average score of snakes with same size score + diedOnTurn
+
+    int backPtr = 0;
+    int frontPtr = 0;
+    float totalScore = 0;
+    int numSnakes = 0;
+    while (frontPtr < snakePtrs.size()) {
+        if (snakeSizeScore(*snakePtrs[frontPtr]) == snakeSizeScore(*snakePtrs[backPtr]) && snakePtrs[frontPtr]->diedOnTurn == snakePtrs[backPtr]->diedOnTurn) {
+            totalScore += scores[frontPtr];
+            numSnakes++;
+            frontPtr++;
+        } else {
+            float score = totalScore / numSnakes;
+
+            for (int i = backPtr; i < frontPtr; i++) {
+                scores[i] = score;
+                ranks.push_back(backPtr + 1);
+                numTies.push_back(numSnakes);
+            }
+
+            backPtr = frontPtr;
+            totalScore = 0;
+            numSnakes = 0;
+        }
+    }
+
+    float score = totalScore / numSnakes;
+
+    for (int i = backPtr; i < frontPtr; i++) {
+        scores[i] = score;
+        ranks.push_back(backPtr + 1);
+        numTies.push_back(numSnakes);
+    }
+
+    int totalChange = 0;
+    std::vector<int> changes;
+    for (int i = 0; i < snakePtrs.size(); i++) {
+        float score = scores[i];
+        float expectedScore = expectedScores[snakePtrs[i]->getID()];
+        float scoreDiff = score - expectedScore;
+
+        int change = ((int) (scoreDiff * ELO_K * (snakePtrs.size() - 1)));
+        totalChange += change;
+
+        changes.push_back(change);
+    }
+
+    //Sometimes because of rounding, the total change is not exactly zero. In that case we just punish the bottom or reward the top
+    if (totalChange < 0) {
+        changes[0] -= totalChange;
+    } else if (totalChange > 0) {
+        changes[changes.size() - 1] -= totalChange;
+    }
+
+    results.resize(this->snakes.size());
+
+    for (int i = 0; i < snakePtrs.size(); i++) {
+        Snake* snake = snakePtrs[i];
+
+        results[snake->getID()] = {
+                !snake->isAlive(),
+                snake->getSize(),
+                snakeSizeScore(*snake),
+                snake->diedOnTurn,
+                ranks[i],
+                numTies[i],
+                elos[snake->getID()] + changes[i]
+        };
+    }
+}
+
+GameConfig::SnakeConfig::SnakeConfig(std::initializer_list<Pos> body)
+    :back({0, 0})
+{
+    assert(body.size() > 0);
+
+    this->back = *body.begin();
+
+    auto itFrom = body.begin(), itTo = body.begin() + 1;
+
+    for (int i = 0; i < body.size() - 1; i++) {
+        this->body.push_back(getMove(*itFrom, *itTo));
+        itFrom++;
+        itTo++;
+    }
+}
+
+GameConfig GameConfig::fromFile(const std::string& filename) {
+    using namespace nlohmann;
+
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+
+    json root;
+    file >> root;
+
+    unsigned int numRows = root["num_rows"];
+    unsigned int numCols = root["num_cols"];
+    unsigned int numFood = root["num_food"];
+
+    std::vector<GameConfig::SnakeConfig> snakes;
+
+    if (root["snakes"].size() > Cell::MAX_SNAKES) {
+        throw std::runtime_error("Layout " + filename + " has more than " + std::to_string(Cell::MAX_SNAKES) + " snakes");
+    }
+
+    for (json snakeJson : root["snakes"]) {
+        SnakeConfig snakeConfig;
+
+        snakeConfig.back = {snakeJson["back"][0], snakeJson["back"][1]};
+
+        for (std::string moveName: snakeJson["body"]) {
+            snakeConfig.body.push_back(getMove(moveName));
+        }
+
+        snakes.push_back(snakeConfig);
+    }
+
+    return {numRows, numCols, numFood, snakes};
+}
+
+static Move getMove(std::string name) {
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    if (name == "up" || name == "u" || name == "north" || name == "n") {
+        return Move::UP;
+    } else if (name == "down" || name == "d" || name == "south" || name == "s") {
+        return Move::DOWN;
+    } else if (name == "left" || name == "l" || name == "west" || name == "w") {
+        return Move::LEFT;
+    } else if (name == "right" || name == "r" || name == "east" || name == "e") {
+        return Move::RIGHT;
+    } else {
+        throw std::runtime_error("Invalid move name: " + name);
+    }
+}
@@ -0,0 +1,57 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#include "Pacing.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool pacingModeFromName(const std::string& name, PacingMode& mode) {
+    if (name == "fixed") {
+        mode = PacingMode::FIXED;
+    } else if (name == "fast") {
+        mode = PacingMode::FAST;
+    } else if (name == "adaptive") {
+        mode = PacingMode::ADAPTIVE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+const char* pacingModeName(PacingMode mode) {
+    switch (mode) {
+        case PacingMode::FIXED: return "fixed";
+        case PacingMode::FAST: return "fast";
+        case PacingMode::ADAPTIVE: return "adaptive";
+    }
+
+    return "unknown";
+}
+
+void ResponseTimes::add(uint32_t us) {
+    this->samples[this->next] = us;
+    this->next = (this->next + 1) % RESPONSE_TIME_SAMPLES;
+
+    if (this->count < RESPONSE_TIME_SAMPLES) {
+        this->count++;
+    }
+}
+
+uint32_t ResponseTimes::percentile(float p) const {
+    if (this->count == 0) {
+        return 0;
+    }
+
+    //Small enough to copy and partially sort every time it is asked for
+    uint32_t sorted[RESPONSE_TIME_SAMPLES];
+    std::copy(this->samples, this->samples + this->count, sorted);
+
+    auto rank = (unsigned int) std::ceil(std::clamp(p, 0.0f, 1.0f) * (float) this->count);
+    unsigned int k = rank > 0 ? rank - 1 : 0;
+
+    std::nth_element(sorted, sorted + k, sorted + this->count);
+    return sorted[k];
+}
@@ -0,0 +1,27 @@
+//
+// Created by Anatol on 23/06/2022.
+//
+
+#include "Player.h"
+#include "Game.h"
+
+#include <algorithm>
+
+void Player::moveReady() {
+    if (this->awaitingMoveFor == nullptr) {
+        return;
+    }
+
+    recordResponseTime();
+
+    Game* game = this->awaitingMoveFor;
+    this->awaitingMoveFor = nullptr;
+    game->onMoveReady();
+}
+
+void Player::recordResponseTime() {
+    using namespace std::chrono;
+
+    auto us = duration_cast<microseconds>(GameClock::now() - this->askedAt).count();
+    this->responseTimes.add((uint32_t) std::min<long long>(us, UINT32_MAX));
+}
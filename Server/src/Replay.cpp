@@ -0,0 +1,264 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#include "Replay.h"
+
+#include <cstring>
+#include <iostream>
+
+//The file is written in big chunks, a record is a few hundred bytes
+#define REPLAY_FILE_BUFFER (64 * 1024)
+
+template<typename T>
+static void put(std::vector<char>& out, T value) {
+    size_t at = out.size();
+    out.resize(at + sizeof(T));
+    memcpy(out.data() + at, &value, sizeof(T));
+}
+
+template<typename T>
+static bool get(const char*& data, const char* end, T& value) {
+    if (end - data < (ptrdiff_t) sizeof(T)) return false;
+
+    memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+}
+
+void Replay::encode(std::vector<char>& out) const {
+    size_t start = out.size();
+
+    put<uint32_t>(out, REPLAY_MAGIC);
+    put<uint8_t>(out, REPLAY_VERSION);
+    //Length of the whole record, filled in at the end
+    put<uint32_t>(out, 0);
+
+    put<uint64_t>(out, serial);
+    put<uint64_t>(out, seed);
+    put<int64_t>(out, startTime);
+
+    put<uint16_t>(out, config.numRows);
+    put<uint16_t>(out, config.numCols);
+    put<uint16_t>(out, config.numFood);
+    put<uint8_t>(out, config.snakes.size());
+
+    for (auto& snake : config.snakes) {
+        put<uint16_t>(out, snake.back.row);
+        put<uint16_t>(out, snake.back.col);
+        put<uint16_t>(out, snake.body.size());
+
+        //Same packing as the moves
+        for (size_t i = 0; i < snake.body.size(); i += 4) {
+            uint8_t packed = 0;
+            for (size_t j = i; j < i + 4 && j < snake.body.size(); j++) {
+                packed |= snake.body[j] << ((j - i) * 2);
+            }
+            put<uint8_t>(out, packed);
+        }
+    }
+
+    put<uint8_t>(out, players.size());
+
+    for (auto& player : players) {
+        size_t nameLength = MIN_T(player.name.size(), (size_t) 255);
+
+        put<uint8_t>(out, nameLength);
+        out.insert(out.end(), player.name.begin(), player.name.begin() + nameLength);
+
+        put<uint8_t>(out, player.color.r);
+        put<uint8_t>(out, player.color.g);
+        put<uint8_t>(out, player.color.b);
+        put<int32_t>(out, player.elo);
+    }
+
+    put<uint32_t>(out, numTurns);
+
+    put<uint16_t>(out, timeouts.size());
+    for (auto& timeout : timeouts) {
+        put<uint32_t>(out, timeout.turn);
+        put<uint8_t>(out, timeout.snake);
+    }
+
+    put<uint32_t>(out, numMoves);
+    out.insert(out.end(), moves.begin(), moves.end());
+
+    put<uint8_t>(out, results.size());
+    for (auto& result : results) {
+        put<uint8_t>(out, result.died);
+        put<uint32_t>(out, result.length);
+        put<uint32_t>(out, result.diedOn);
+        put<uint8_t>(out, result.rank);
+        put<int32_t>(out, result.newElo);
+    }
+
+    uint32_t length = out.size() - start;
+    memcpy(out.data() + start + 5, &length, sizeof(length));
+}
+
+bool Replay::decode(const char*& data, const char* end, Replay& replay) {
+    const char* start = data;
+    const char* p = data;
+
+    uint32_t magic, length;
+    uint8_t version;
+
+    if (!get(p, end, magic) || !get(p, end, version) || !get(p, end, length)) return false;
+    if (magic != REPLAY_MAGIC || version != REPLAY_VERSION || length > end - start) return false;
+
+    //Nothing is read past the record, even if it claims otherwise
+    end = start + length;
+
+    uint16_t numRows, numCols, numFood;
+    uint8_t numSnakes;
+
+    if (!get(p, end, replay.serial) || !get(p, end, replay.seed) || !get(p, end, replay.startTime)) return false;
+    if (!get(p, end, numRows) || !get(p, end, numCols) || !get(p, end, numFood) || !get(p, end, numSnakes)) return false;
+
+    replay.config.numRows = numRows;
+    replay.config.numCols = numCols;
+    replay.config.numFood = numFood;
+    replay.config.snakes.clear();
+
+    for (unsigned int i = 0; i < numSnakes; i++) {
+        uint16_t row, col, bodyLength;
+        if (!get(p, end, row) || !get(p, end, col) || !get(p, end, bodyLength)) return false;
+
+        std::vector<Move> body;
+        uint8_t packed = 0;
+
+        for (unsigned int j = 0; j < bodyLength; j++) {
+            if (j % 4 == 0 && !get(p, end, packed)) return false;
+            body.push_back((Move) ((packed >> (j % 4 * 2)) & 3));
+        }
+
+        replay.config.snakes.emplace_back(Pos{row, col}, body);
+    }
+
+    uint8_t numPlayers;
+    if (!get(p, end, numPlayers)) return false;
+
+    replay.players.clear();
+
+    for (unsigned int i = 0; i < numPlayers; i++) {
+        uint8_t nameLength;
+        PlayerInfo player;
+
+        if (!get(p, end, nameLength) || end - p < nameLength) return false;
+        player.name.assign(p, nameLength);
+        p += nameLength;
+
+        int32_t elo;
+        if (!get(p, end, player.color.r) || !get(p, end, player.color.g) || !get(p, end, player.color.b) || !get(p, end, elo)) return false;
+        player.elo = elo;
+
+        replay.players.push_back(player);
+    }
+
+    uint16_t numTimeouts;
+    if (!get(p, end, replay.numTurns) || !get(p, end, numTimeouts)) return false;
+
+    replay.timeouts.clear();
+
+    for (unsigned int i = 0; i < numTimeouts; i++) {
+        uint32_t turn;
+        uint8_t snake;
+
+        if (!get(p, end, turn) || !get(p, end, snake)) return false;
+        replay.timeouts.push_back({turn, snake});
+    }
+
+    uint32_t numMoves;
+    if (!get(p, end, numMoves)) return false;
+
+    size_t moveBytes = (numMoves + 3) / 4;
+    if ((size_t) (end - p) < moveBytes) return false;
+
+    replay.numMoves = numMoves;
+    replay.moves.assign(p, p + moveBytes);
+    p += moveBytes;
+
+    uint8_t numResults;
+    if (!get(p, end, numResults)) return false;
+
+    replay.results.clear();
+
+    for (unsigned int i = 0; i < numResults; i++) {
+        uint8_t died, rank;
+        uint32_t length, diedOn;
+        int32_t newElo;
+
+        if (!get(p, end, died) || !get(p, end, length) || !get(p, end, diedOn) || !get(p, end, rank) || !get(p, end, newElo)) return false;
+        replay.results.push_back({died != 0, length, diedOn, rank, newElo});
+    }
+
+    data = end;
+    return true;
+}
+
+ReplayWriter::ReplayWriter(const std::string& path) {
+    this->file = fopen(path.c_str(), "ab");
+
+    if (!this->file) {
+        std::cerr << "Failed to open replay file " << path << ", games won't be recorded" << std::endl;
+        return;
+    }
+
+    setvbuf(this->file, nullptr, _IOFBF, REPLAY_FILE_BUFFER);
+
+    this->thread = std::thread(&ReplayWriter::run, this);
+}
+
+ReplayWriter::~ReplayWriter() {
+    if (!this->file) return;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->condition.notify_one();
+
+    this->thread.join();
+    fclose(this->file);
+}
+
+void ReplayWriter::write(const Replay& replay) {
+    if (!this->file) return;
+
+    std::vector<char> record;
+    replay.encode(record);
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->pending.push_back(std::move(record));
+    }
+    this->condition.notify_one();
+}
+
+void ReplayWriter::run() {
+    std::deque<std::vector<char>> writing;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->condition.wait(lock, [this]() {
+                return this->stopping || !this->pending.empty();
+            });
+
+            if (this->pending.empty()) {
+                //Only stopping gets here
+                return;
+            }
+
+            writing.swap(this->pending);
+        }
+
+        for (auto& record : writing) {
+            fwrite(record.data(), 1, record.size(), this->file);
+        }
+        writing.clear();
+
+        //A crash shouldn't lose more than what is still in the queue
+        fflush(this->file);
+    }
+}
@@ -0,0 +1,242 @@
+//
+// Created by Anatol on 25/06/2022.
+//
+
+#include "../headers/SearchPlayer.h"
+#include "../headers/Game.h"
+
+#include <chrono>
+#include <bit>
+
+//How far ahead a playout goes
+#define PLAYOUT_TURNS 10
+
+//How many turns out the squares closer to us than to the other heads are counted. Bounds the cost on big boards
+#define PARTITION_DEPTH 16
+
+//Score weights. Room is counted in squares
+#define TRAPPED_PENALTY 1000.f
+#define HEAD_PENALTY 500.f
+#define FOOD_BONUS 20.f
+#define FOOD_DISTANCE_WEIGHT 2.f
+#define PLAYOUT_WEIGHT 200.f
+
+SearchPlayer::SearchPlayer(std::string name, Color color, unsigned int budgetUs)
+    :Player(color, name),
+    budgetUs(budgetUs),
+    rolloutRng(GameRng::randomSeed())
+{}
+
+void SearchPlayer::prepareNextMove(Game& game, Snake& snake) {
+    this->savedMove = chooseMove(game, snake);
+
+    moveReady();
+}
+
+void SearchPlayer::prepareScratch(const Game& game) {
+    if (!this->scratch || this->scratch->getNumIndices() != game.getNumIndices()) {
+        this->scratch = std::make_unique<GameState>(game.fork());
+        this->space = std::make_unique<SpaceSearch>(game.getNumIndices(), game.getStride());
+    }
+
+    this->moves.resize(game.getSnakes().size(), UP);
+    this->owned.resize(game.getSnakes().size(), 0);
+}
+
+static unsigned int distance(Pos a, Pos b) {
+    return (a.row > b.row ? a.row - b.row : b.row - a.row) + (a.col > b.col ? a.col - b.col : b.col - a.col);
+}
+
+Move SearchPlayer::chooseMove(const Game& game, const Snake& snake) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(this->budgetUs);
+
+    prepareScratch(game);
+
+    const BitBoard& open = game.getOpen();
+    const BitBoard& food = game.getFood();
+    unsigned int stride = game.getStride();
+
+    float scores[4];
+    bool safe[4];
+    unsigned int numSafe = 0;
+    Move onlyMove = UP;
+
+    //The cheap part: whether the move is safe, head on collisions and food
+    for (Move move : ALL_MOVES) {
+        Pos target = snake.getHead() + move;
+        unsigned int targetIdx = game.indexOf(target);
+
+        safe[move] = open.test(targetIdx);
+        if (!safe[move]) continue;
+
+        numSafe++;
+        onlyMove = move;
+        float score = 0;
+
+        for (const Snake& other : game.getSnakes()) {
+            if (!other.isAlive() || other.getID() == snake.getID()) continue;
+
+            //Both snakes die if it goes there too
+            if (distance(target, other.getHead()) == 1) {
+                score -= HEAD_PENALTY;
+            }
+        }
+
+        if (food.test(targetIdx)) {
+            score += FOOD_BONUS;
+        } else {
+            unsigned int nearest = ~0u;
+
+            for (unsigned int w = 0; w < food.getNumWords(); w++) {
+                for (uint64_t bits = food.words()[w]; bits; bits &= bits - 1) {
+                    unsigned int i = w * 64 + std::countr_zero(bits);
+                    nearest = MIN_T(nearest, distance(target, {i / stride - 1, i % stride - 1}));
+                }
+            }
+
+            if (nearest != ~0u) {
+                score -= FOOD_DISTANCE_WEIGHT * nearest;
+            }
+        }
+
+        scores[move] = score;
+    }
+
+    if (numSafe == 0) {
+        return UP;
+    }
+
+    if (numSafe == 1) {
+        return onlyMove;
+    }
+
+    //The room each move leaves. Only used if every move got scored before the budget ran out, so the moves are
+    //compared on the same terms
+    float room[4];
+    bool roomScored = true;
+
+    for (Move move : ALL_MOVES) {
+        if (!safe[move]) continue;
+
+        if (std::chrono::steady_clock::now() >= deadline) {
+            roomScored = false;
+            break;
+        }
+
+        unsigned int targetIdx = game.indexOf(snake.getHead() + move);
+        float score = 0;
+
+        //Anything past twice our length is plenty, no need to fill the rest of the board
+        unsigned int reached = this->space->reachable(open, targetIdx, snake.getSize() * 2);
+        if (reached < snake.getSize()) {
+            score -= TRAPPED_PENALTY - reached;
+        }
+
+        this->heads.clear();
+        this->heads.push_back(targetIdx);
+
+        for (const Snake& other : game.getSnakes()) {
+            if (!other.isAlive() || other.getID() == snake.getID()) continue;
+
+            this->heads.push_back(game.indexOf(other.getHead()));
+        }
+
+        this->space->partition(open, this->heads.data(), this->heads.size(), this->owned.data(), PARTITION_DEPTH);
+        score += this->owned[0];
+
+        room[move] = score;
+    }
+
+    if (roomScored) {
+        for (Move move : ALL_MOVES) {
+            if (safe[move]) {
+                scores[move] += room[move];
+            }
+        }
+    }
+
+    //Playouts with whatever is left of the budget, checked before every one
+    float survived[4] = {0, 0, 0, 0};
+    unsigned int runs[4] = {0, 0, 0, 0};
+    bool outOfTime = false;
+
+    while (!outOfTime) {
+        for (Move move : ALL_MOVES) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                outOfTime = true;
+                break;
+            }
+
+            if (!safe[move]) continue;
+
+            survived[move] += playout(game, snake.getID(), move);
+            runs[move]++;
+        }
+    }
+
+    for (Move move : ALL_MOVES) {
+        if (runs[move] > 0) {
+            scores[move] += PLAYOUT_WEIGHT * survived[move] / runs[move];
+        }
+    }
+
+    Move best = UP;
+    float bestScore = 0;
+    bool found = false;
+
+    for (Move move : ALL_MOVES) {
+        if (safe[move] && (!found || scores[move] > bestScore)) {
+            best = move;
+            bestScore = scores[move];
+            found = true;
+        }
+    }
+
+    return best;
+}
+
+void SearchPlayer::pickRandomMoves(const GameState& state) {
+    const BitBoard& open = state.getOpen();
+
+    for (const Snake& snake : state.getSnakes()) {
+        if (!snake.isAlive()) continue;
+
+        Move options[4];
+        unsigned int numOptions = 0;
+
+        for (Move move : ALL_MOVES) {
+            if (open.test(state.indexOf(snake.getHead() + move))) {
+                options[numOptions++] = move;
+            }
+        }
+
+        this->moves[snake.getID()] = numOptions > 0 ? options[this->rolloutRng.below(numOptions)] : UP;
+    }
+}
+
+float SearchPlayer::playout(const Game& game, unsigned int snake, Move first) {
+    GameState& state = *this->scratch;
+
+    game.forkInto(state);
+    state.reseed(this->rolloutRng.next());
+
+    for (unsigned int turn = 0; turn < PLAYOUT_TURNS; turn++) {
+        pickRandomMoves(state);
+        if (turn == 0) {
+            this->moves[snake] = first;
+        }
+
+        state.clearDeaths();
+        state.step(this->moves.data());
+
+        if (!state.getSnakes()[snake].isAlive()) {
+            return turn / (float) PLAYOUT_TURNS;
+        }
+
+        if (state.hasGameEnded()) {
+            break;
+        }
+    }
+
+    return 1.f;
+}
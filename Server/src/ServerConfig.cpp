@@ -0,0 +1,74 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#include "ServerConfig.h"
+
+#include <json/json.hpp>
+#include <fstream>
+#include <iostream>
+
+//Keys that are missing keep what pacing already has
+static void readPacing(const nlohmann::json& json, Pacing& pacing) {
+    std::string modeName = json.value("mode", std::string(pacingModeName(pacing.mode)));
+    if (!pacingModeFromName(modeName, pacing.mode)) {
+        std::cerr << "Unknown pacing mode " << modeName << ", using " << pacingModeName(pacing.mode) << std::endl;
+    }
+
+    pacing.minTurnMs = json.value("min_turn_ms", pacing.minTurnMs);
+    pacing.timeoutMs = json.value("timeout_ms", pacing.timeoutMs);
+    pacing.percentile = json.value("percentile", pacing.percentile);
+    pacing.margin = json.value("margin", pacing.margin);
+    pacing.minTimeoutMs = json.value("min_timeout_ms", pacing.minTimeoutMs);
+}
+
+ServerConfig ServerConfig::fromFile(const std::string& filename) {
+    using namespace nlohmann;
+
+    ServerConfig config;
+
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "No server config at " << filename << ", using defaults" << std::endl;
+        return config;
+    }
+
+    json root;
+    file >> root;
+
+    config.ip = root.value("ip", config.ip);
+    config.numGames = root.value("num_games", config.numGames);
+    config.numThreads = root.value("num_threads", config.numThreads);
+    config.layout = root.value("layout", config.layout);
+    config.maxSendBuffer = root.value("max_send_buffer", config.maxSendBuffer);
+    config.replayFile = root.value("replay_file", config.replayFile);
+    config.numBots = root.value("num_bots", config.numBots);
+    config.botType = root.value("bot_type", config.botType);
+    config.botBudgetUs = root.value("bot_budget_us", config.botBudgetUs);
+
+    if (root.contains("pacing")) {
+        readPacing(root["pacing"], config.pacing);
+    }
+
+    return config;
+}
+
+Pacing ServerConfig::pacingFor(const std::string& layoutFile) const {
+    using namespace nlohmann;
+
+    Pacing result = this->pacing;
+
+    std::ifstream file(layoutFile);
+    if (!file.is_open()) {
+        return result;
+    }
+
+    json root;
+    file >> root;
+
+    if (root.contains("pacing")) {
+        readPacing(root["pacing"], result);
+    }
+
+    return result;
+}
@@ -4,19 +4,25 @@
 
 #include "../headers/Snake.h"
 
-Snake::Snake(Player *player, unsigned int id)
-    :id(id), player(player)
+Snake::Snake(Player *player, unsigned int id, size_t maxLength)
+    :id(id), body(maxLength), player(player)
 {
 
 }
 
+void Snake::reset(Player* newPlayer) {
+    this->player = newPlayer;
+    this->body.clear();
+    this->head = {1 << 30, 1 << 30};
+    this->alive = true;
+    this->sizeOnDeath = 0;
+}
+
 void Snake::pushPos(Pos newHead) {
     this->body.push(newHead);
     this->head = newHead;
 }
 
 Pos Snake::retractTail() {
-    Pos tail = this->body.front();
-    this->body.pop();
-    return tail;
+    return this->body.pop();
 }
@@ -1,18 +1,27 @@
 #include <iostream>
+#include <chrono>
 
 #include "Game.h"
 #include "DummyPlayer.h"
-#include "render/GameDisplay.h"
 #include "GameCreator.h"
-#include "render/ImGuiRenderer.h"
+#include "ServerConfig.h"
 #include "network/snake_network.h"
 
+#ifdef SNAKE_HEADLESS
+#include "AllocationCounter.h"
+#else
+#include "render/ImGuiRenderer.h"
+#include "render/ServerDisplay.h"
+
 class MyRenderer: public ImGuiRenderer {
 public:
     GameCreator* gameCreator;
     ConnectionManager* connectionManager;
+    ServerDisplay display;
 
-    MyRenderer(GameCreator* gameCreator, ConnectionManager* connectionManager) {
+    MyRenderer(GameCreator* gameCreator, ConnectionManager* connectionManager, unsigned int numDisplays)
+        :display(gameCreator, numDisplays)
+    {
         this->gameCreator = gameCreator;
         this->connectionManager = connectionManager;
     }
@@ -20,21 +29,72 @@ protected:
     void render() override {
         this->gameCreator->tick();
         this->connectionManager->tick();
-        this->gameCreator->render();
+        this->display.render();
     }
 };
+#endif
+
+//Longest the headless loop blocks on the network when no game is due
+#define HEADLESS_MAX_WAIT_MS 100
+//How often the headless server logs its counters
+#define STATS_INTERVAL_S 60
+
+int main(int argc, char** argv) {
+    ServerConfig serverConfig = ServerConfig::fromFile(SERVER_CONFIG_PATH);
+
+    if (argc > 1) {
+        serverConfig.ip = argv[1];
+    } else if (serverConfig.ip.empty()) {
+        std::cout << "Enter ip: ";
+        std::cin >> serverConfig.ip;
+    }
 
-int main() {
-    std::string ip;
+#ifndef SNAKE_HEADLESS
+    //The windows draw games while they are being played, so they have to run on this thread
+    serverConfig.numThreads = 0;
+#endif
 
-    std::cout << "Enter ip: ";
-    std::cin >> ip;
+    GameCreator gameCreator(serverConfig);
+    ConnectionManager connectionManager(serverConfig.ip.c_str(), &gameCreator, serverConfig.maxSendBuffer);
 
-    GameCreator gameCreator(2);
-    ConnectionManager connectionManager(ip.c_str(), &gameCreator);
-    MyRenderer renderer(&gameCreator, &connectionManager);
+    gameCreator.start([&connectionManager]() {
+        connectionManager.wakeUp();
+    });
+
+#ifdef SNAKE_HEADLESS
+    auto lastStats = std::chrono::steady_clock::now();
+    unsigned long long lastAllocations = heapAllocations();
+    unsigned long long lastTurns = Game::turnsPlayed();
+    unsigned long long lastPoolAllocations = SharedBufferPool::allocationsWhileFull();
+
+    while (true) {
+        gameCreator.tick();
+        connectionManager.tick(gameCreator.msUntilNextTick(HEADLESS_MAX_WAIT_MS));
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastStats > std::chrono::seconds(STATS_INTERVAL_S)) {
+            lastStats = now;
+
+            unsigned long long allocations = heapAllocations();
+            unsigned long long turns = Game::turnsPlayed();
+            unsigned long long poolAllocations = SharedBufferPool::allocationsWhileFull();
+
+            //New games and players allocate, turns in between shouldn't. Unless connections fall so far behind that
+            //the changes buffers they still hold can't be reused, which is counted on its own
+            std::cout << "Heap allocations: " << allocations - lastAllocations << " in " << turns - lastTurns
+                      << " turns, " << poolAllocations - lastPoolAllocations
+                      << " of them for changes while slow connections held every pooled buffer" << std::endl;
+
+            lastAllocations = allocations;
+            lastTurns = turns;
+            lastPoolAllocations = poolAllocations;
+        }
+    }
+#else
+    MyRenderer renderer(&gameCreator, &connectionManager, serverConfig.numGames);
 
     renderer.init();
     renderer.mainloop();
     renderer.cleanup();
+#endif
 }
@@ -4,166 +4,295 @@
 #include "network/snake_network.h"
 
 #include <iostream>
-#include <winsock.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "utils.h"
 #include "Game.h"
 #include "GameCreator.h"
+#include "GameShard.h"
+#include "SharedBuffer.h"
 
-#pragma comment (lib, "ws2_32.lib")
+//Seconds a connection gets to send NAME_AND_COLOR before it is dropped
+#define HANDSHAKE_TIMEOUT_S 10
 
-bool initSock = false;
-
-static void initWinsock() {
-    if (initSock) {
-        return;
-    }
-    initSock = true;
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(1, 1), &wsaData);
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
 }
 
-ConnectionManager::ConnectionManager(const char* ip, GameCreator* gameCreator)
-    :creator(gameCreator)
+ConnectionManager::ConnectionManager(const char* ip, GameCreator* gameCreator, size_t maxSendBuffer)
+    :creator(gameCreator),
+    maxSendBuffer(maxSendBuffer)
 {
-    initWinsock();
-
     serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    epollFd = epoll_create1(0);
+    wakeFd = eventfd(0, EFD_NONBLOCK);
 
-    if (serverSocket == INVALID_SOCKET) {
+    if (serverSocket == -1 || epollFd == -1 || wakeFd == -1) {
         std::cerr << "Failed to create socket" << std::endl;
         return;
     }
 
-    sockaddr_in serverAddress;
+    int reuse = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in serverAddress{};
     serverAddress.sin_family = AF_INET;
     serverAddress.sin_port = htons(PORT);
     inet_pton(AF_INET, ip, &(serverAddress.sin_addr));
 
-    bind(serverSocket, (sockaddr*)&serverAddress, sizeof(serverAddress));
+    if (bind(serverSocket, (sockaddr*)&serverAddress, sizeof(serverAddress)) == -1) {
+        std::cerr << "Failed to bind: " << strerror(errno) << std::endl;
+    }
     listen(serverSocket, SOMAXCONN);
+    setNonBlocking(serverSocket);
 
-    FD_ZERO(&listener);
-    FD_SET(serverSocket, &listener);
+    //The listener is registered with a null pointer, the wake up eventfd with the manager, connections with their Connection*
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = nullptr;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSocket, &event);
 
-    FD_ZERO(&allConnections);
+    event.data.ptr = this;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
 
     std::cout << "Listening on ip " << ip << " on port " << PORT << std::endl;
 }
 
-void ConnectionManager::tick() {
-    //Check if there is a new connection
-    fd_set  copy = listener;
+void ConnectionManager::tick(int timeoutMs) {
+    epoll_event events[MAX_EPOLL_EVENTS];
+
+    //Whatever the games queued since the last tick
+    flushPending();
 
-    timeval timeout = { 0, 10 };
+    int numEvents = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, timeoutMs);
+
+    for (int i = 0; i < numEvents; i++) {
+        auto* conn = (Connection*) events[i].data.ptr;
+
+        if (conn == nullptr) {
+            acceptConnections();
+            continue;
+        } else if (events[i].data.ptr == this) {
+            uint64_t count;
+            read(wakeFd, &count, sizeof(count));
+            continue;
+        }
+
+        //Failed connections are left for dropBadConnections, it may delete them
+        if (conn->removed || conn->failed) continue;
+
+        bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+
+        if (alive && (events[i].events & EPOLLOUT)) {
+            alive = conn->flush();
+        }
 
-    int socketCount = select(0, &copy, nullptr, nullptr, &timeout);
+        if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+            alive = conn->onReadable();
+        }
+
+        if (!alive) {
+            handleDeadConnection(conn);
+        }
+    }
+
+    flushPending();
+    dropBadConnections();
+}
+
+void ConnectionManager::flushPending() {
+    for (Connection* conn: pendingFlush) {
+        conn->flushQueued = false;
+
+        if (!conn->flush()) {
+            conn->failed = true;
+        }
+    }
+
+    pendingFlush.clear();
+}
 
-    if (socketCount) {
-        SOCKET sock = copy.fd_array[0];
-        SOCKET client = accept(sock, nullptr, nullptr);
+void ConnectionManager::acceptConnections() {
+    //Edge-triggered, so accept everything that is queued
+    while (true) {
+        int client = accept4(serverSocket, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
 
-        if (client == INVALID_SOCKET) {
-            std::cerr << "Failed to accept connection" << std::endl;
+        if (client == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Failed to accept connection: " << strerror(errno) << std::endl;
+            }
             return;
         }
 
         std::cout << "New connection" << std::endl;
 
-        Connection* connection =new Connection(client, time(NULL), this);
+        //Packets are already batched per tick, Nagle would only hold back the move request
+        int noDelay = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        Connection* connection = new Connection(client, time(NULL), this, maxSendBuffer);
 
         connections.push_back(connection);
         connectionMap[client] = connection;
 
-        FD_SET(client, &allConnections);
+        epoll_event event{};
+        //Edge-triggered EPOLLOUT only fires when a full socket drains, so it costs nothing while sends keep up
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = connection;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &event);
     }
+}
 
+void ConnectionManager::dropBadConnections() {
+    time_t now = time(NULL);
+
+    std::vector<Connection*> bad;
     for (Connection* conn: this->connections) {
-        if(!conn->tick()) {
-            handleDeadConnection(conn);
+        if (conn->failed || (!conn->player && now - conn->createdAt > HANDSHAKE_TIMEOUT_S)) {
+            bad.push_back(conn);
         }
     }
 
-    for (auto* conn: this->connections) {
-        if (!conn->player) {
-            if (conn->createdAt - time(NULL) > 10) {
-                handleDeadConnection(conn);
-            }
-        }
+    for (Connection* conn: bad) {
+        handleDeadConnection(conn);
     }
 }
 
+void ConnectionManager::wakeUp() {
+    uint64_t one = 1;
+    write(wakeFd, &one, sizeof(one));
+}
+
 ConnectionManager::~ConnectionManager() {
-    closesocket(serverSocket);
+    close(serverSocket);
+    close(epollFd);
+    close(wakeFd);
 
     for (Connection* connection : connections) {
-        closesocket(connection->socket);
+        close(connection->socket);
         delete connection;
     }
+}
 
-    if (initSock) {
-        WSACleanup();
-        initSock = false;
+
+void Connection::sendData(const char* data, int len, SharedBuffer* payload) {
+    //The socket is already closed (and its number may have been reused), the player just hasn't been cleaned up yet
+    if (removed || failed) return;
+
+    if (!sendBuffer.append(data, len, payload)) {
+        std::cerr << "Client is not keeping up with what we send, dropping it" << std::endl;
+        failed = true;
+        return;
+    }
+
+    if (!flushQueued) {
+        flushQueued = true;
+        manager->pendingFlush.push_back(this);
     }
 }
 
+bool Connection::flush() {
+    iovec parts[MAX_SEND_PARTS];
+    msghdr message{};
+    message.msg_iov = parts;
+
+    while (!sendBuffer.empty()) {
+        message.msg_iovlen = sendBuffer.fillParts(parts, MAX_SEND_PARTS);
+
+        ssize_t res = sendmsg(socket, &message, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                //The rest goes out on EPOLLOUT
+                return true;
+            } else if (errno == EINTR) {
+                continue;
+            }
 
-void Connection::sendData(const char* data, int len) {
-    int sent = 0;
-    while (sent < len) {
-        int res = send(socket, data + sent, len - sent, 0);
-        if (res == SOCKET_ERROR || res == 0) {
-            std::cerr << "Failed to send data" << std::endl;
-            return;
+            std::cerr << "Failed to send data: " << strerror(errno) << std::endl;
+            return false;
         }
-        sent += res;
+
+        sendBuffer.consume(res);
     }
+
+    return true;
 }
 
-Connection::Connection(SOCKET i, time_t i1, ConnectionManager* manager) {
-    socket = i;
-    createdAt = i1;
+Connection::Connection(int socket, time_t createdAt, ConnectionManager* manager, size_t maxSendBuffer)
+    :sendBuffer(INITIAL_SEND_BUFFER, maxSendBuffer)
+{
+    this->socket = socket;
+    this->createdAt = createdAt;
     this->manager = manager;
 }
 
 bool Connection::handle(char packetType, const char* data, int len) {
     Color playerColor;
-    char* name;
     char move;
     std::string playerName;
 
-    char* p_data;
     switch (packetType) {
         case NAME_AND_COLOR:
-            if (this->player != nullptr) return false;
+            if (this->player != nullptr || len < 3) return false;
 
             unsigned char color[3];
             memcpy(color, data, 3);
 
             playerColor = {color[0], color[1], color[2]};
 
-            name = new char[len - 3];
+            {
+                const char* name = data + 3;
+                int nameLength = len - 3;
+
+                //Newer clients end the name with a 0 and say which protocol they speak after it
+                auto* end = (const char*) memchr(name, 0, nameLength);
 
-            memcpy(name, data + 3, len - 3);
+                if (end != nullptr) {
+                    nameLength = end - name;
+                    readHandshakeExtension(end + 1, data + len - (end + 1));
+                }
 
-            playerName = std::string(name, len - 3).substr(0, 15);
+                playerName = std::string(name, nameLength).substr(0, 15);
+            }
             playerName = this->manager->creator->getPlayerName(playerName);
             playerColor = this->manager->creator->getPlayerColor(playerColor);
 
             this->player = new NetworkPlayer(playerName, playerColor, this);
 
-            int length;
-            p_data = makeConnectionEstablishedPacket(length);
-            sendData(p_data, length);
-            delete[] p_data;
+            SmallPacket packet;
+            makeConnectionEstablishedPacket(packet, this->protocolVersion, this->capabilities);
+            sendData(packet.data, packet.len);
 
             this->manager->creator->addPlayer(this->player);
 
-            std::cout << "Received info from " << playerName << std::endl;
+            std::cout << "Received info from " << playerName << " (protocol " << (int) this->protocolVersion
+                      << ", capabilities " << this->capabilities << ")" << std::endl;
 
             break;
-        case MOVE_RESPONSE:
-            if (this->player == nullptr || len != 1) return false;
+        case MOVE_RESPONSE: {
+            if (this->player == nullptr) return false;
+
+            std::optional<unsigned int> turn;
+
+            if (len == 5 && (this->capabilities & CAP_TURN_TAGGED_MOVES)) {
+                uint32_t taggedTurn;
+                memcpy(&taggedTurn, data + 1, 4);
+                turn = taggedTurn;
+            } else if (len != 1) {
+                return false;
+            }
 
             move = data[0];
 
@@ -172,8 +301,12 @@ bool Connection::handle(char packetType, const char* data, int len) {
                 return false;
             }
 
-            this->player->receiveMove((Move) move);
+            //The game may be running on another thread
+            if (this->player->shard) {
+                this->player->shard->postMove(this->player, (Move) move, turn);
+            }
             break;
+        }
         default:
             std::cerr << "Unknown packet type" << std::endl;
             return false;
@@ -182,62 +315,66 @@ bool Connection::handle(char packetType, const char* data, int len) {
     return true;
 }
 
-bool Connection::tick() {
-    timeval timeout = { 0, 10 };
+void Connection::readHandshakeExtension(const char* data, int len) {
+    if (len < 1) return;
+
+    auto version = (uint8_t) data[0];
+    this->protocolVersion = version < 1 ? 1 : MIN_T(version, PROTOCOL_VERSION);
+
+    //Version 1 has no capabilities
+    if (this->protocolVersion < 2) return;
 
-    auto hasData = [this]() {
-        fd_set test;
-        FD_ZERO(&test);
-        FD_SET(socket, &test);
-        timeval timeout = { 0, 10 };
-        select(0, &test, nullptr, nullptr, &timeout);
-        return FD_ISSET(socket, &test);
-    };
+    if (len >= 5) {
+        uint32_t requested;
+        memcpy(&requested, data + 1, 4);
 
+        this->capabilities = requested & SERVER_CAPABILITIES;
+    } else {
+        //Version 2 clients from before capabilities existed only had compact changes
+        this->capabilities = CAP_COMPACT_CHANGES;
+    }
+}
+
+bool Connection::onReadable() {
     while (true) {
-        if (this->currState == AWAITING_HEADER) {
-            if (!hasData()) break;
-            int recvd = recv(socket, (char*) (this->header + this->headerReceived), 4 - this->headerReceived, 0);
+        int recvd = recv(socket, this->recvBuffer + this->recvLength, RECV_BUFFER_SIZE - this->recvLength, 0);
 
-            if (recvd <= 0) {
-                return false;
+        if (recvd == 0) {
+            return false;
+        } else if (recvd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            } else if (errno == EINTR) {
+                continue;
             }
+            return false;
+        }
 
-            this->headerReceived += recvd;
+        this->recvLength += recvd;
 
-            if (this->headerReceived == 4) {
-                this->currState = AWAITING_BODY;
-                this->bodyLength = ((unsigned char*) this->header)[0] | (((unsigned char*) this->header)[1] << 8);
-                this->bodyReceived = 0;
+        //Handle every complete packet in the buffer
+        int offset = 0;
+        while (this->recvLength - offset >= 4) {
+            auto* header = (unsigned char*) (this->recvBuffer + offset);
+            int bodyLength = header[0] | (header[1] << 8);
 
-                if (this->bodyLength == 0) {
-                    this->currState = COMPLETE;
-                }
-            }
-        } else if (this->currState == AWAITING_BODY) {
-            if (!hasData()) break;
-            int rcvd = recv(socket, this->body + this->bodyReceived, this->bodyLength - this->bodyReceived, 0);
-            if (rcvd <= 0) {
+            if (bodyLength > MAX_INWARD_BODY) {
+                std::cerr << "Packet too large" << std::endl;
                 return false;
             }
 
-            this->bodyReceived += rcvd;
+            if (this->recvLength - offset < 4 + bodyLength) break;
 
-            if (this->bodyReceived == this->bodyLength) {
-                this->currState = COMPLETE;
-            }
-        } else if (this->currState == COMPLETE) {
-            char packetType = this->header[2];
-            if (!this->handle(packetType, this->body, this->bodyLength)) {
+            if (!this->handle((char) header[2], this->recvBuffer + offset + 4, bodyLength)) {
                 return false;
             }
 
-            this->currState = AWAITING_HEADER;
-            this->headerReceived = 0;
+            offset += 4 + bodyLength;
         }
-    }
 
-    return true;
+        memmove(this->recvBuffer, this->recvBuffer + offset, this->recvLength - offset);
+        this->recvLength -= offset;
+    }
 }
 
 NetworkPlayer::NetworkPlayer(std::string name, Color color, Connection* c)
@@ -247,34 +384,159 @@ NetworkPlayer::NetworkPlayer(std::string name, Color color, Connection* c)
 
 }
 
-void NetworkPlayer::receiveMove(Move move) {
+void NetworkPlayer::receiveMove(Move move, std::optional<unsigned int> turn) {
+    if (turn.has_value() && (!this->askedTurn.has_value() || *turn > *this->askedTurn)) {
+        queueMove(*turn, move);
+        return;
+    }
+
+    //Too late, that turn has been played
+    if (turn.has_value() && *turn < *this->askedTurn) return;
+
     this->receivedMove = std::optional<Move>(move);
+    moveReady();
+}
+
+void NetworkPlayer::queueMove(unsigned int turn, Move move) {
+    unsigned int first = this->askedTurn.has_value() ? *this->askedTurn + 1 : 0;
+    if (turn >= first + MAX_QUEUED_MOVES) return;
+
+    //Sorted insert. A second move for the same turn replaces the first, like it does for the turn being asked
+    unsigned int i = 0;
+    while (i < this->numQueuedMoves && this->queuedMoves[i].turn < turn) {
+        i++;
+    }
+
+    if (i < this->numQueuedMoves && this->queuedMoves[i].turn == turn) {
+        this->queuedMoves[i].move = move;
+        return;
+    }
+
+    if (this->numQueuedMoves == MAX_QUEUED_MOVES) return;
+
+    for (unsigned int j = this->numQueuedMoves; j > i; j--) {
+        this->queuedMoves[j] = this->queuedMoves[j - 1];
+    }
+
+    this->queuedMoves[i] = {turn, move};
+    this->numQueuedMoves++;
+}
+
+void NetworkPlayer::send(const SmallPacket& packet, SharedBuffer* payload) {
+    if (this->shard) {
+        //Game callbacks run on the shard's thread, the main thread does the actual sending
+        this->shard->postPacket(this->connection, packet, payload);
+    } else {
+        this->connection->sendData(packet.data, packet.len, payload);
+
+        if (payload) {
+            payload->release();
+        }
+    }
+}
+
+void NetworkPlayer::drop(const std::string& reason) {
+    //Only logged once, what the game sends until the connection is gone is skipped anyway
+    if (this->kicked.exchange(true)) return;
+
+    std::cerr << "Dropping " << getName() << ": " << reason << std::endl;
+
+    if (this->shard) {
+        this->shard->postDropConnection(this->connection);
+    } else {
+        this->connection->failed = true;
+    }
 }
 
 void NetworkPlayer::beginGame(Game &game, Snake &snake) {
-    int length;
-    char* data = makeGameStartPacket(length, game, snake);
+    //Turns start again from 0
+    this->askedTurn = std::nullopt;
+    this->numQueuedMoves = 0;
 
-    connection->sendData(data, length);
+    SmallPacket packet;
+    makeGameStartPacket(packet, game, snake);
 
-    delete[] data;
+    send(packet);
+}
+
+SharedBuffer* NetworkPlayer::changesPayload(Game& game, Changes& changes) {
+    //The changes are the same for everyone, only the head position in front of them is ours.
+    //Each format is encoded by the first player that needs it
+    SharedBuffer* payload;
+
+    if (this->connection->capabilities & CAP_COMPACT_CHANGES) {
+        if (!changes.isCompactEncoded) {
+            encodeCompactChangesPayload(changes, game.getNumCols());
+        }
+
+        payload = changes.compactEncoded;
+    } else {
+        if (!changes.isEncoded) {
+            encodeGameChangesPayload(changes);
+        }
+
+        payload = changes.encoded;
+    }
+
+    payload->retain();
+    return payload;
 }
 
 void NetworkPlayer::receiveChanges(Game &game, Snake &snake, Changes &changes) {
-    int length;
-    char* data = makeGameChangesPacket(length, game, snake, changes);
+    if (this->connection->capabilities & CAP_MOVE_IN_CHANGES) {
+        //The move request comes straight after, in the same tick
+        releaseHeldChanges(game, snake);
+        this->heldChanges = &changes;
+        return;
+    }
 
-    connection->sendData(data, length);
+    SharedBuffer* payload = changesPayload(game, changes);
+    SmallPacket packet;
 
-    delete[] data;
+    if (this->connection->capabilities & CAP_COMPACT_CHANGES) {
+        makeCompactChangesHeader(packet, game, snake, payload);
+    } else if (!makeGameChangesHeader(packet, snake, payload)) {
+        //Anything sent after a wrong length would be misread, so the client can't be kept
+        payload->release();
+        drop("Turn " + std::to_string(changes.newTurn) + " has more changes than GAME_CHANGES can hold, "
+             "the client has to ask for compact changes on this board");
+        return;
+    }
+
+    send(packet, payload);
 
 #ifdef _DEBUG
-    data = makeWholeGridPacket(length, game);
-    connection->sendData(data, length);
-    delete[] data;
+    SmallPacket empty;
+    empty.len = 0;
+    send(empty, makeWholeGridPacket(game));
 #endif
 }
 
+void NetworkPlayer::sendTurn(Game& game, Snake& snake, Changes& changes, bool moveDue) {
+    SharedBuffer* payload = changesPayload(game, changes);
+
+    SmallPacket packet;
+    makeTurnHeader(packet, game, snake, this->connection->capabilities & CAP_COMPACT_CHANGES,
+                   moveDue ? TURN_MOVE_DUE : 0, changes.newTurn, moveDue ? game.getMoveTimeoutMs() : 0, payload);
+
+    send(packet, payload);
+
+#ifdef _DEBUG
+    SmallPacket empty;
+    empty.len = 0;
+    send(empty, makeWholeGridPacket(game));
+#endif
+}
+
+void NetworkPlayer::releaseHeldChanges(Game& game, Snake& snake) {
+    if (this->heldChanges) {
+        Changes* changes = this->heldChanges;
+        this->heldChanges = nullptr;
+
+        sendTurn(game, snake, *changes, false);
+    }
+}
+
 void NetworkPlayer::onRemoved() {
     //Remove connection from manager
 
@@ -284,12 +546,13 @@ void NetworkPlayer::onRemoved() {
                                                                  this->connection),
                                                      this->connection->manager->connections.end());
         this->connection->manager->connectionMap.erase(this->connection->socket);
+        this->connection->manager->pendingFlush.erase(std::remove(this->connection->manager->pendingFlush.begin(),
+                                                                  this->connection->manager->pendingFlush.end(),
+                                                                  this->connection),
+                                                      this->connection->manager->pendingFlush.end());
 
-        //Remove connection from allConnections
-        FD_CLR(this->connection->socket, &this->connection->manager->allConnections);
-
-        //Close socket
-        closesocket(this->connection->socket);
+        //Closing the socket also removes it from the epoll set
+        close(this->connection->socket);
     }
 
     //Delete connection
@@ -301,51 +564,82 @@ void NetworkPlayer::onRemoved() {
 
 void ConnectionManager::handleDeadConnection(Connection* conn) {
     std::cout << "Connection closed" << std::endl;
-    FD_CLR(conn->socket, &allConnections);
     connections.erase(std::remove(connections.begin(), connections.end(), conn), connections.end());
     connectionMap.erase(conn->socket);
-    closesocket(conn->socket);
+    pendingFlush.erase(std::remove(pendingFlush.begin(), pendingFlush.end(), conn), pendingFlush.end());
+    close(conn->socket);
+
+    conn->removed = true;
 
     if (!conn->player) {
         delete conn;
     } else {
         conn->player->kicked = true;
     }
-
-    conn->removed = true;
 }
 
 void NetworkPlayer::prepareNextMove(Game &game, Snake &snake) {
-    int length;
-    char* packet = makeMoveRequestPacket(length);
-
     this->receivedMove = std::nullopt;
-    this->connection->sendData(packet, length);
+    this->askedTurn = game.getTurn();
 
-    delete[] packet;
+    //Take a move that came in early for this turn, and forget any for turns that went by
+    unsigned int used = 0;
+    while (used < this->numQueuedMoves && this->queuedMoves[used].turn <= *this->askedTurn) {
+        if (this->queuedMoves[used].turn == *this->askedTurn) {
+            this->receivedMove = this->queuedMoves[used].move;
+        }
+        used++;
+    }
+
+    this->numQueuedMoves -= used;
+    for (unsigned int i = 0; i < this->numQueuedMoves; i++) {
+        this->queuedMoves[i] = this->queuedMoves[i + used];
+    }
+
+    //The request still goes out, the client needs the changes either way
+    sendMoveRequest(game, snake);
+
+    if (this->receivedMove.has_value()) {
+        moveReady();
+    }
+}
+
+void NetworkPlayer::sendMoveRequest(Game& game, Snake& snake) {
+    if (this->heldChanges) {
+        Changes* changes = this->heldChanges;
+        this->heldChanges = nullptr;
+
+        sendTurn(game, snake, *changes, true);
+        return;
+    }
+
+    SmallPacket packet;
+    makeMoveRequestPacket(packet);
+
+    send(packet);
 }
 
 std::optional<Move> NetworkPlayer::queryNextMove() {
     return this->receivedMove;
 }
 
-void NetworkPlayer::onDeath(Game &game, Snake &snake, std::string reason, bool timeout) {
-    int length;
-    char* packet = makeSnakeDeadPacket(length, reason);
+void NetworkPlayer::onDeath(Game &game, Snake &snake, const std::string& reason, bool timeout) {
+    releaseHeldChanges(game, snake);
 
-    this->connection->sendData(packet, length);
+    SmallPacket packet;
+    makeSnakeDeadPacket(packet, reason);
 
-    delete[] packet;
+    send(packet);
 }
 
 void NetworkPlayer::endGame(Game &game, Snake &snake, bool died, unsigned int length, int score, unsigned int diedOn,
                             unsigned int rank, unsigned int numTies, int newElo) {
-    int packetLength;
-    char* packet = makeGameResultsPacket(packetLength, died, length, score, diedOn, rank, numTies, newElo);
+    releaseHeldChanges(game, snake);
 
-    this->connection->sendData(packet, packetLength);
+    SmallPacket packet;
+    makeGameResultsPacket(packet, died, length, score, diedOn, rank, numTies, newElo);
 
-    delete[] packet;
+    send(packet);
 }
 
 template<typename T>
@@ -354,154 +648,212 @@ int write(void* buf, T data) {
     return sizeof(T);
 }
 
-char* makeConnectionEstablishedPacket(int& len) {
-    char* packet = new char[4];
+//Fills in the 4 byte header and returns where the body goes.
+//followingLength is for bodies that continue in a payload sent straight after the packet
+static char* beginPacket(SmallPacket& packet, OutwardBoundPacketType type, unsigned short bodyLength, size_t followingLength = 0) {
+    assert(4 + bodyLength <= SMALL_PACKET_SIZE);
+    assert(bodyLength + followingLength <= MAX_SHORT_PACKET_BODY);
 
-    packet[0] = 0; //Length
-    packet[1] = 0; //Length
+    auto totalLength = (unsigned short) (bodyLength + followingLength);
 
-    packet[2] = CONNECTION_ESTABLISHED; //Type
-    packet[3] = 0; //Padding
+    packet.data[0] = totalLength & 0xFF; //Length
+    packet.data[1] = totalLength >> 8; //Length
 
-    len = 4;
+    packet.data[2] = type; //Type
+    packet.data[3] = 0; //Padding
 
-    return packet;
+    packet.len = 4 + bodyLength;
+
+    return packet.data + 4;
 }
 
-char* makeMoveRequestPacket(int& len) {
-    char* packet = new char[4];
+//The same for bodies that may not fit in 16 bits, which have 0 there and a 4 byte length after the header
+static char* beginLongPacket(SmallPacket& packet, OutwardBoundPacketType type, unsigned int bodyLength, unsigned int followingLength = 0) {
+    assert(8 + bodyLength <= SMALL_PACKET_SIZE);
 
-    packet[0] = 0; //Length
-    packet[1] = 0; //Length
+    beginPacket(packet, type, 0);
 
-    packet[2] = MOVE_REQUEST; //Type
-    packet[3] = 0; //Padding
+    uint32_t totalLength = bodyLength + followingLength;
+    memcpy(packet.data + 4, &totalLength, 4);
 
-    len = 4;
+    packet.len = 8 + bodyLength;
 
-    return packet;
+    return packet.data + 8;
 }
 
-char* makeGameChangesPacket(int& len, Game& game, Snake& snake, Changes& changes) {
-    unsigned short bodyLength = 8 + 4;
+static int writeVarint(char* buf, uint32_t value) {
+    int n = 0;
 
-    for (auto& change: changes.changes) {
-        if (change.second.type == SquareType::SNAKE) {
-            bodyLength += 13;
-        } else {
-            bodyLength += 9;
-        }
+    while (value >= 0x80) {
+        buf[n++] = (char) (value | 0x80);
+        value >>= 7;
     }
 
-    char* packet = new char[4 + bodyLength];
+    buf[n++] = (char) value;
 
-    packet[0] = bodyLength & 0xFF; //Length
-    packet[1] = bodyLength >> 8; //Length
+    return n;
+}
 
-    packet[2] = GAME_CHANGES; //Type
-    packet[3] = 0; //Padding
+void makeConnectionEstablishedPacket(SmallPacket& packet, uint8_t protocolVersion, uint32_t capabilities) {
+    //Version 1 clients only read the header
+    if (protocolVersion < 2) {
+        beginPacket(packet, CONNECTION_ESTABLISHED, 0);
+        return;
+    }
 
-    char* buf = packet + 4;
+    char* buf = beginPacket(packet, CONNECTION_ESTABLISHED, 1 + 4);
 
-    buf += write(buf, snake.getHead().row);
-    buf += write(buf, snake.getHead().col);
+    buf += write(buf, protocolVersion);
+    buf += write(buf, capabilities);
+}
+
+void makeMoveRequestPacket(SmallPacket& packet) {
+    beginPacket(packet, MOVE_REQUEST, 0);
+}
+
+void encodeGameChangesPayload(Changes& changes) {
+    size_t payloadLength = 4;
+
+    for (auto& change: changes.changes) {
+        if (change.second.isSnake()) {
+            payloadLength += 13;
+        } else {
+            payloadLength += 9;
+        }
+    }
+
+    //An earlier turn's buffer is reused once the network thread is done with it, which it normally is
+    changes.encoded = changes.encodedBuffers.acquire(payloadLength);
+    changes.isEncoded = true;
+
+    char* buf = changes.encoded->data();
 
     buf += write(buf, changes.newTurn);
 
     for (auto& change : changes.changes) {
         buf += write(buf, change.first.row);
         buf += write(buf, change.first.col);
-        buf += write(buf, change.second.type);
+        buf += write(buf, change.second.type());
 
-        if (change.second.type == SquareType::SNAKE) {
-            buf += write(buf, change.second.snakeID);
+        if (change.second.isSnake()) {
+            buf += write(buf, change.second.snakeID());
         }
     }
+}
 
-    len = 4 + bodyLength;
+bool makeGameChangesHeader(SmallPacket& packet, Snake& snake, SharedBuffer* payload) {
+    if (8 + payload->size() > MAX_SHORT_PACKET_BODY) {
+        return false;
+    }
 
-    return packet;
-}
+    char* buf = beginPacket(packet, GAME_CHANGES, 8, payload->size());
 
-char* makeGameStartPacket(int& len, Game& game, Snake& snake) {
-    short bodyLength = 8 /*dimensions*/ + 4 /*id*/;
+    buf += write(buf, snake.getHead().row);
+    buf += write(buf, snake.getHead().col);
 
-    char* packet = new char[4 + bodyLength];
+    return true;
+}
 
-    packet[0] = bodyLength & 0xFF; //Length
-    packet[1] = bodyLength >> 8; //Length
+void encodeCompactChangesPayload(Changes& changes, unsigned int numCols) {
+    //Every varint fits in 5 bytes, the buffer is cut down to what was used
+    changes.compactEncoded = changes.compactEncodedBuffers.acquire(5 + changes.changes.size() * 6);
+    changes.isCompactEncoded = true;
 
-    packet[2] = GAME_START; //Type
-    packet[3] = 0; //Padding
+    char* start = changes.compactEncoded->data();
+    char* buf = start;
 
-    char* buf = packet + 4;
+    buf += writeVarint(buf, changes.newTurn);
 
-    buf += write(buf, game.getNumRows());
-    buf += write(buf, game.getNumCols());
-    buf += write(buf, snake.getID());
+    //Changes are sorted by position, so indices only go up
+    unsigned int previous = 0;
 
-    len = 4 + bodyLength;
+    for (auto& change : changes.changes) {
+        unsigned int index = change.first.row * numCols + change.first.col;
 
-    return packet;
-}
+        buf += writeVarint(buf, index - previous);
+        previous = index;
 
-char* makeWholeGridPacket(int& len, Game& game) {
-    short bodyLength = game.getNumRows() * game.getNumCols() * 5;
+        Cell cell = change.second;
+        *buf++ = (char) (cell.isSnake() ? 2 + cell.snakeID() : cell.value);
+    }
 
-    char* packet = new char[4 + bodyLength];
+    changes.compactEncoded->resize(buf - start);
+}
 
-    packet[0] = bodyLength & 0xFF; //Length
-    packet[1] = bodyLength >> 8; //Length
+void makeCompactChangesHeader(SmallPacket& packet, Game& game, Snake& snake, SharedBuffer* payload) {
+    char head[5];
+    int headLength = writeVarint(head, snake.getHead().row * game.getNumCols() + snake.getHead().col);
 
-    packet[2] = WHOLE_GRID; //Type
-    packet[3] = 0; //Padding
+    char* buf = beginLongPacket(packet, GAME_CHANGES_V2, headLength, payload->size());
+    memcpy(buf, head, headLength);
+}
 
-    char* buf = packet + 4;
+void makeTurnHeader(SmallPacket& packet, Game& game, Snake& snake, bool compact, uint8_t flags, unsigned int turn,
+                    uint32_t deadlineMs, SharedBuffer* payload) {
+    //Our head, as the changes packet would have started
+    char head[8];
+    int headLength;
 
-    for (unsigned int i = 0; i < game.getNumRows(); i++) {
-        for (unsigned int j = 0; j < game.getNumCols(); j++) {
-            buf += write(buf, game.getSquare({i, j}).type);
-            buf += write(buf, game.getSquare({i, j}).snakeID);
-        }
+    if (compact) {
+        headLength = writeVarint(head, snake.getHead().row * game.getNumCols() + snake.getHead().col);
+    } else {
+        headLength = write(head, snake.getHead().row);
+        headLength += write(head + headLength, snake.getHead().col);
     }
 
-    len = 4 + bodyLength;
+    char* buf = beginLongPacket(packet, TURN, 1 + 4 + 4 + headLength, payload->size());
 
-    return packet;
+    buf += write(buf, flags);
+    buf += write(buf, (uint32_t) turn);
+    buf += write(buf, deadlineMs);
+    memcpy(buf, head, headLength);
 }
 
-char* makeSnakeDeadPacket(int& len, std::string& reason) {
-    short bodyLength = reason.length();
+void makeGameStartPacket(SmallPacket& packet, Game& game, Snake& snake) {
+    char* buf = beginPacket(packet, GAME_START, 8 /*dimensions*/ + 4 /*id*/);
 
-    char* packet = new char[4 + bodyLength];
+    buf += write(buf, game.getNumRows());
+    buf += write(buf, game.getNumCols());
+    buf += write(buf, snake.getID());
+}
+
+#ifdef _DEBUG
+SharedBuffer* makeWholeGridPacket(Game& game) {
+    unsigned short bodyLength = game.getNumRows() * game.getNumCols() * 5;
 
-    packet[0] = bodyLength & 0xFF; //Length
-    packet[1] = bodyLength >> 8; //Length
+    SharedBuffer* packet = SharedBuffer::create(4 + bodyLength);
+    char* buf = packet->data();
 
-    packet[2] = SNAKE_DEAD; //Type
-    packet[3] = 0; //Padding
+    buf[0] = bodyLength & 0xFF; //Length
+    buf[1] = bodyLength >> 8; //Length
 
-    char* buf = packet + 4;
+    buf[2] = WHOLE_GRID; //Type
+    buf[3] = 0; //Padding
 
-    memcpy(buf, reason.c_str(), reason.length());
+    buf += 4;
 
-    len = 4 + bodyLength;
+    for (unsigned int i = 0; i < game.getNumRows(); i++) {
+        for (unsigned int j = 0; j < game.getNumCols(); j++) {
+            buf += write(buf, game.getSquare({i, j}).type);
+            buf += write(buf, game.getSquare({i, j}).snakeID);
+        }
+    }
 
     return packet;
 }
+#endif
 
-char* makeGameResultsPacket(int& len, bool died, unsigned int length, int score, unsigned int diedOn, unsigned int rank, unsigned int numTies, int newElo) {
-    short bodyLength = 1 + 4 + 4 + 4 + 4 + 4 + 4;
-
-    char* packet = new char[4 + bodyLength];
+void makeSnakeDeadPacket(SmallPacket& packet, const std::string& reason) {
+    //Reasons are short, but they have to fit
+    unsigned short bodyLength = MIN_T(reason.length(), (size_t) SMALL_PACKET_SIZE - 4);
 
-    packet[0] = bodyLength & 0xFF; //Length
-    packet[1] = bodyLength >> 8; //Length
+    char* buf = beginPacket(packet, SNAKE_DEAD, bodyLength);
 
-    packet[2] = GAME_RESULTS; //Type
-    packet[3] = 0; //Padding
+    memcpy(buf, reason.c_str(), bodyLength);
+}
 
-    char* buf = packet + 4;
+void makeGameResultsPacket(SmallPacket& packet, bool died, unsigned int length, int score, unsigned int diedOn, unsigned int rank, unsigned int numTies, int newElo) {
+    char* buf = beginPacket(packet, GAME_RESULTS, 1 + 4 + 4 + 4 + 4 + 4 + 4);
 
     buf += write(buf, died);
     buf += write(buf, length);
@@ -510,8 +862,4 @@ char* makeGameResultsPacket(int& len, bool died, unsigned int length, int score,
     buf += write(buf, rank);
     buf += write(buf, numTies);
     buf += write(buf, newElo);
-
-    len = 4 + bodyLength;
-
-    return packet;
-}
\ No newline at end of file
+}
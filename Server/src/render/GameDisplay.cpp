@@ -3,6 +3,7 @@
 //
 
 #include <sstream>
+#include <algorithm>
 #include "render/GameDisplay.h"
 
 #include "imgui.h"
@@ -125,24 +126,16 @@ void GameDisplay::renderWindow() {
     }
 
     //Draw snakes
-    for (auto snake : game->snakes) {
+    for (const Snake& snake : game->snakes) {
         if (!snake.isAlive()) continue;
 
         Player *player = snake.getPlayer();
         Color color = player->getColor();
-        std::queue<Pos> bodyRef = snake.getBody();
-        std::queue<Pos> body = bodyRef;
+        const SnakeBody& body = snake.getBody();
 
-        std::vector<Pos> bodyVec;
-
-        while (!body.empty()) {
-            bodyVec.push_back(body.front());
-            body.pop();
-        }
-
-        for (unsigned int j = 0; j < bodyVec.size() - 1; j++) {
-            Pos from = bodyVec[j];
-            Pos to = bodyVec[j + 1];
+        for (unsigned int j = 0; j + 1 < body.size(); j++) {
+            Pos from = body[j];
+            Pos to = body[j + 1];
 
             //Draw between the squares from and to, in the margin
             switch (getMove(from, to)) {
@@ -191,14 +184,16 @@ void GameDisplay::renderWindow() {
 
         Move headDirection;
 
-        if (bodyVec.size() > 1) {
-            headDirection = getMove(bodyVec[bodyVec.size() - 2], bodyVec.back());
+        const Pos& head = body[body.size() - 1];
+
+        if (body.size() > 1) {
+            headDirection = getMove(body[body.size() - 2], head);
         } else {
             headDirection = UP;
         }
 
-        float headCenterX = gridBaseDrawX + bodyVec.back().col * gridCellWidthWithMargin + gridCellWidth / 2;
-        float headCenterY = gridBaseDrawY + rowToGridY(bodyVec.back().row) * gridCellHeightWithMargin + gridCellHeight / 2;
+        float headCenterX = gridBaseDrawX + head.col * gridCellWidthWithMargin + gridCellWidth / 2;
+        float headCenterY = gridBaseDrawY + rowToGridY(head.row) * gridCellHeightWithMargin + gridCellHeight / 2;
 
         float eyeBaseX = headCenterX + 0.3f * MOVES[headDirection].second * gridCellWidth;
         float eyeBaseY = headCenterY + 0.3f * MOVES[headDirection].first * gridCellHeight;
@@ -0,0 +1,107 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#include "render/ServerDisplay.h"
+#include "GameCreator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+ServerDisplay::ServerDisplay(GameCreator* creator, unsigned int numDisplays)
+    :creator(creator)
+{
+    for (unsigned int i = 0; i < numDisplays; i++) {
+        this->displays.emplace_back(GameDisplay());
+    }
+
+    memset(this->fileBuf, 0, 64);
+    strncpy(this->fileBuf, creator->serverConfig.layout.c_str(), 63);
+}
+
+void ServerDisplay::render() {
+    assignGames();
+
+    for (GameDisplay& display : this->displays) {
+        display.renderWindow();
+    }
+
+    renderLeaderboard();
+    renderOptions();
+}
+
+void ServerDisplay::assignGames() {
+    //The window runs shards on this thread, so their games can be read directly
+    std::vector<Game*> games;
+    for (auto& shard : creator->shards) {
+        games.insert(games.end(), shard->games.begin(), shard->games.end());
+    }
+
+    //Games that ended since the last frame have already been deleted by the creator
+    for (GameDisplay& display : this->displays) {
+        if (display.game != nullptr && std::find(games.begin(), games.end(), display.game) == games.end()) {
+            display.game = nullptr;
+        }
+    }
+
+    for (Game* game : games) {
+        bool shown = false;
+        for (GameDisplay& display : this->displays) {
+            if (display.game == game) {
+                shown = true;
+                break;
+            }
+        }
+
+        if (shown) continue;
+
+        for (GameDisplay& display : this->displays) {
+            if (display.game == nullptr) {
+                display.game = game;
+                break;
+            }
+        }
+    }
+}
+
+void ServerDisplay::renderLeaderboard() {
+    ImGui::Begin("Leaderboard");
+    ImGui::Text("Leaderboard");
+    ImGui::BeginChild("Leaderboard", ImVec2(0, 0), true);
+
+    std::vector<Player*> players = creator->players;
+
+    //Sort players by elo
+    std::sort(players.begin(), players.end(), [](Player* a, Player* b) {
+        return a->getElo() > b->getElo();
+    });
+
+    //Render players
+    for (Player* player : players) {
+        ImGui::PushStyleColor(ImGuiCol_Text, (uint32_t) player->getColor());
+        ImGui::Text("%s: %d", player->getName().c_str(), player->getElo());
+        ImGui::PopStyleColor();
+    }
+
+    ImGui::EndChild();
+    ImGui::End();
+}
+
+void ServerDisplay::renderOptions() {
+    ImGui::Begin("Options");
+
+    //Text entry for layout path
+    ImGui::InputText("Layout path", this->fileBuf, 64);
+
+    if (ImGui::Button("Update")) {
+        try {
+            creator->config = GameConfig::fromFile(layoutPath(this->fileBuf));
+            creator->pacing = creator->serverConfig.pacingFor(layoutPath(this->fileBuf));
+        } catch (std::runtime_error& e) {
+            std::cout << "Error: " << e.what() << std::endl;
+        }
+    }
+
+    ImGui::End();
+}
@@ -0,0 +1,211 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+/*
+ * Re-runs recorded games through the rules and checks they end the way the server said they did.
+ * Doubles as the benchmark for the rules: nothing but GameState runs here.
+ *
+ *   SnakeReplay [-j threads] [-r repeats] replays.bin...
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+
+#include "GameState.h"
+#include "Replay.h"
+
+//Only the first few mismatches are printed in full
+#define MAX_REPORTED_MISMATCHES 20
+
+static bool readFile(const std::string& path, std::vector<char>& out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+//Plays the game again and compares it with what was recorded. Returns an empty string if they match
+static std::string resimulate(const Replay& replay, unsigned long long& turns) {
+    std::vector<Player*> players(replay.players.size(), nullptr);
+    GameState state(replay.config, players, replay.seed, false);
+
+    const std::vector<Snake>& snakes = state.getSnakes();
+
+    if (snakes.size() != replay.players.size() || replay.results.size() != snakes.size()) {
+        return "recorded " + std::to_string(replay.players.size()) + " players for " + std::to_string(snakes.size()) + " snakes";
+    }
+
+    std::vector<Move> moves(snakes.size(), UP);
+    size_t nextMove = 0;
+    size_t nextTimeout = 0;
+
+    for (unsigned int turn = 0; turn < replay.numTurns; turn++) {
+        if (state.hasGameEnded()) {
+            return "ended on turn " + std::to_string(turn) + " instead of " + std::to_string(replay.numTurns);
+        }
+
+        while (nextTimeout < replay.timeouts.size() && replay.timeouts[nextTimeout].turn == turn) {
+            unsigned int snake = replay.timeouts[nextTimeout].snake;
+
+            if (snake >= snakes.size() || !snakes[snake].isAlive()) {
+                return "bad timeout on turn " + std::to_string(turn);
+            }
+
+            state.timeOut(snake);
+            nextTimeout++;
+        }
+
+        for (const Snake& snake : snakes) {
+            if (!snake.isAlive()) continue;
+
+            if (nextMove >= replay.numMoves) {
+                return "ran out of moves on turn " + std::to_string(turn);
+            }
+
+            moves[snake.getID()] = replay.getMove(nextMove++);
+        }
+
+        state.step(moves.data());
+        state.clearDeaths();
+    }
+
+    turns += replay.numTurns;
+
+    if (!state.hasGameEnded()) {
+        return "still going after " + std::to_string(replay.numTurns) + " turns";
+    }
+
+    if (nextMove != replay.numMoves || nextTimeout != replay.timeouts.size()) {
+        return "didn't use every recorded move";
+    }
+
+    std::vector<int> elos;
+    for (auto& player : replay.players) {
+        elos.push_back(player.elo);
+    }
+
+    std::vector<SnakeResult> results;
+    state.computeResults(elos, results);
+
+    std::ostringstream differences;
+
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const SnakeResult& got = results[i];
+        const Replay::Result& expected = replay.results[i];
+
+        if (got.died != expected.died || got.length != expected.length || got.diedOn != expected.diedOn
+            || got.rank != expected.rank || got.newElo != expected.newElo) {
+            differences << " " << replay.players[i].name << ": length " << got.length << "/" << expected.length
+                        << ", died on " << got.diedOn << "/" << expected.diedOn
+                        << ", rank " << got.rank << "/" << expected.rank
+                        << ", elo " << got.newElo << "/" << expected.newElo << ";";
+        }
+    }
+
+    if (differences.tellp() > 0) {
+        return "results differ (re-run/recorded):" + differences.str();
+    }
+
+    return "";
+}
+
+int main(int argc, char** argv) {
+    unsigned int numThreads = std::thread::hardware_concurrency();
+    unsigned int repeats = 1;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            numThreads = std::stoul(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repeats = std::stoul(argv[++i]);
+        } else {
+            paths.emplace_back(argv[i]);
+        }
+    }
+
+    if (paths.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [-j threads] [-r repeats] replays.bin..." << std::endl;
+        return 2;
+    }
+
+    numThreads = numThreads > 0 ? numThreads : 1;
+    repeats = repeats > 0 ? repeats : 1;
+
+    std::vector<Replay> replays;
+    bool corrupt = false;
+
+    for (const std::string& path : paths) {
+        std::vector<char> bytes;
+        if (!readFile(path, bytes)) {
+            std::cerr << "Could not open " << path << std::endl;
+            return 2;
+        }
+
+        const char* data = bytes.data();
+        const char* end = data + bytes.size();
+
+        while (data < end) {
+            Replay replay;
+            if (!Replay::decode(data, end, replay)) {
+                std::cerr << path << ": unreadable record at byte " << (data - bytes.data()) << ", skipping the rest" << std::endl;
+                corrupt = true;
+                break;
+            }
+
+            replays.push_back(std::move(replay));
+        }
+    }
+
+    std::cout << "Re-running " << replays.size() << " games " << repeats << " times on " << numThreads << " threads" << std::endl;
+
+    std::atomic<size_t> nextJob = 0;
+    std::atomic<unsigned long long> totalTurns = 0;
+    std::atomic<unsigned int> numMismatches = 0;
+    std::mutex printMutex;
+
+    size_t numJobs = replays.size() * repeats;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&]() {
+            unsigned long long turns = 0;
+
+            for (size_t job = nextJob++; job < numJobs; job = nextJob++) {
+                const Replay& replay = replays[job % replays.size()];
+                std::string error = resimulate(replay, turns);
+
+                //Only report each game once, not once per repeat
+                if (!error.empty() && job < replays.size()) {
+                    if (numMismatches++ < MAX_REPORTED_MISMATCHES) {
+                        std::lock_guard<std::mutex> lock(printMutex);
+                        std::cout << "Game " << replay.serial << " (seed " << replay.seed << "): " << error << std::endl;
+                    }
+                }
+            }
+
+            totalTurns += turns;
+        });
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Checked " << replays.size() << " games, " << numMismatches << " didn't match" << std::endl;
+    std::cout << totalTurns << " turns in " << seconds << "s, " << (unsigned long long) (totalTurns / (seconds > 0 ? seconds : 1e-9)) << " turns/s" << std::endl;
+
+    return numMismatches > 0 || corrupt ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+//
+// Created by Anatol on 24/06/2022.
+//
+
+#include "snake_env.h"
+#include "BatchEnv.h"
+
+#include <iostream>
+
+struct SnakeBatch {
+    BatchEnv env;
+};
+
+SnakeBatch* snake_batch_create(const char* layout_path, uint32_t num_envs, uint64_t seed, uint32_t max_turns) {
+    //Exceptions can't cross the C boundary
+    try {
+        return new SnakeBatch{BatchEnv(GameConfig::fromFile(layout_path), num_envs, seed, max_turns)};
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to create snake batch: " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+void snake_batch_destroy(SnakeBatch* batch) {
+    delete batch;
+}
+
+uint32_t snake_batch_num_envs(const SnakeBatch* batch) {
+    return batch->env.numEnvs();
+}
+
+uint32_t snake_batch_num_snakes(const SnakeBatch* batch) {
+    return batch->env.numSnakes();
+}
+
+uint32_t snake_batch_num_rows(const SnakeBatch* batch) {
+    return batch->env.numRows();
+}
+
+uint32_t snake_batch_num_cols(const SnakeBatch* batch) {
+    return batch->env.numCols();
+}
+
+void snake_batch_set_buffers(SnakeBatch* batch, uint8_t* observations, float* rewards, uint8_t* dones,
+                             uint8_t* alive, uint32_t* heads) {
+    batch->env.setBuffers({observations, rewards, dones, alive, heads});
+}
+
+void snake_batch_reset(SnakeBatch* batch) {
+    batch->env.reset();
+}
+
+void snake_batch_step(SnakeBatch* batch, const uint8_t* moves) {
+    batch->env.step(moves);
+}